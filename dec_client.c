@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>       // Standard input/output library
 #include <stdlib.h>      // Standard library for memory management and process control
 #include <string.h>      // String handling functions
@@ -5,9 +6,9 @@
 #include <sys/types.h>   // Definitions for data types like `pid_t`
 #include <sys/socket.h>  // Socket programming library
 #include <netdb.h>       // Networking definitions and functions
-#include <fcntl.h>       // File control options for low-level I/O
 
-#define BUFFER_SIZE 100000 // Define the maximum buffer size for messages
+#include "otp_client_core.h" // Streaming file/segment helpers
+#include "otp_protocol.h"    // Wire format shared with the servers
 
 // Function to print an error message and exit
 void error(const char *msg) {
@@ -32,92 +33,205 @@ void setupAddressStruct(struct sockaddr_in* address, int portNumber, char* hostn
     memcpy((char*) &address->sin_addr.s_addr, hostInfo->h_addr_list[0], hostInfo->h_length);
 }
 
-// Read the content of a file into a buffer
-void readFileContent(const char* filename, char* buffer, size_t bufferSize) {
-    memset(buffer, '\0', bufferSize); // Clear the buffer
-    FILE *file = fopen(filename, "r"); // Open the file for reading
-    if (file == NULL) { // Handle error if the file cannot be opened
-        fprintf(stderr, "CLIENT: ERROR opening file %s\n", filename);
-        exit(EXIT_FAILURE);
+// Connect to the decryption server on the given host, or on its local socket
+int connectToServer(const char* port, char* hostname) {
+    struct sockaddr_in serverAddress;
+
+    // A socket path reaches a server on this host without going through TCP
+    if (isLocalAddress(port)) {
+        return connectLocalServer(port);
     }
 
-    // Read the file content into the buffer
-    size_t bytesRead = fread(buffer, sizeof(char), bufferSize - 1, file);
-    if (bytesRead <= 0) { // Handle error if the file is empty or unreadable
-        fprintf(stderr, "CLIENT: ERROR reading file %s\n", filename);
+    // "local" runs single requests in this process; everything else needs a server
+    if (isInProcess(port)) {
+        fprintf(stderr, "CLIENT: ERROR - only ciphertext_file key_file requests run %s\n", OTP_IN_PROCESS);
         exit(EXIT_FAILURE);
     }
 
-    fclose(file); // Close the file
-    buffer[strcspn(buffer, "\n")] = '\0'; // Remove the newline character at the end of the buffer
+    // Create the socket
+    int socketFD = socket(AF_INET, SOCK_STREAM, 0);
+    if (socketFD < 0) {
+        error("CLIENT: ERROR opening socket");
+    }
+
+    // Set up the server address structure
+    setupAddressStruct(&serverAddress, atoi(port), hostname);
+
+    // Connect to the server
+    if (connect(socketFD, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
+        error("CLIENT: ERROR connecting");
+    }
+    return socketFD;
+}
+
+// Read "[-e|-d] ciphertext_file key_file [output_file]" lines from stdin into a request list
+struct clientRequest* readRequestList(const char* outDir, size_t* count) {
+    struct clientRequest* requests = NULL;
+    size_t capacity = 0;
+    char* line = NULL;
+    size_t lineSize = 0;
+
+    *count = 0;
+    while (getline(&line, &lineSize, stdin) > 0) {
+        char* textFile = strtok(line, " \t\r\n");
+        uint8_t op = 0; // Decrypt, unless the line says otherwise
+        if (textFile != NULL && (strcmp(textFile, "-e") == 0 || strcmp(textFile, "-d") == 0)) {
+            // "-e" or "-d" first: encrypt or decrypt this one, for a combined otp_server
+            op = textFile[1] == 'e' ? OTP_OP_ENCRYPT : OTP_OP_DECRYPT;
+            textFile = strtok(NULL, " \t\r\n");
+        }
+        char* keyFile = strtok(NULL, " \t\r\n");
+        char* outFile = strtok(NULL, " \t\r\n"); // Optional
+        if (textFile == NULL) continue; // Skip blank lines
+        if (keyFile == NULL) {
+            fprintf(stderr, "CLIENT: ERROR - expected \"ciphertext_file key_file\" but got \"%s\"\n", textFile);
+            exit(EXIT_FAILURE);
+        }
+
+        // Grow the list as needed
+        if (*count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            requests = realloc(requests, capacity * sizeof(*requests));
+            if (requests == NULL) error("CLIENT: ERROR allocating request list");
+        }
+        requests[*count].op = op;
+        requests[*count].textFile = strdup(textFile);
+        requests[*count].keyFile = strdup(keyFile);
+        if (outFile != NULL) {
+            requests[*count].outFile = strdup(outFile);
+        } else {
+            // Without an output directory, plaintexts go to stdout one line each
+            requests[*count].outFile = outDir != NULL ? batchOutputPath(outDir, textFile) : NULL;
+        }
+        requests[*count].out = stdout;
+        (*count)++;
+    }
+    free(line);
+    return requests;
 }
 
 int main(int argc, char *argv[]) {
+    char hostname[100] = "localhost"; // Default hostname is "localhost"
+
+    // Packed mode (-p): any of the forms below, sending text and key 5 symbols to 3 bytes.
+    // Shared mode (-s): text and key go through shared memory (needs a socket path as the port).
+    // Binary mode (-b): any bytes, combined with XOR against a binary key
+    while (argc > 1 && (strcmp(argv[1], "-p") == 0 || strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "-b") == 0)) {
+        if (argv[1][1] == 'p') usePackedEncoding();
+        else if (argv[1][1] == 'b') useBinaryMode();
+        else useSharedMemory();
+        argv[1] = argv[0]; // Drop the option and parse the rest as usual
+        argv++;
+        argc--;
+    }
+
+    // Batch mode: pipeline every request listed on stdin, or every file of a directory,
+    // over keep-alive connections
+    struct batchOptions batch;
+    int next;
+    if (argc >= 3 && strcmp(argv[1], "-k") == 0 &&
+        (next = parseBatchOptions(argc - 1, argv + 1, &batch)) > 0 && next + 1 < argc && next + 3 >= argc) {
+        if (next + 2 < argc) {
+            strncpy(hostname, argv[next + 2], sizeof(hostname) - 1);
+        }
+        size_t count;
+        struct clientRequest* requests = batch.textDir != NULL ? listBatchDirectory(&batch, &count)
+                                                               : readRequestList(batch.outDir, &count);
+        for (size_t i = 0; i < count && batch.connections > 1; i++) {
+            if (requests[i].outFile == NULL) {
+                fprintf(stderr, "CLIENT: ERROR - -j needs an output file for every request (use -o)\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        int sockets[batch.connections];
+        for (int c = 0; c < batch.connections; c++) {
+            sockets[c] = connectToServer(argv[next + 1], hostname);
+        }
+        size_t failures = runBatch(sockets, batch.connections, OTP_OP_DECRYPT, 0, batch.maxInFlight,
+                                   requests, count);
+        for (int c = 0; c < batch.connections; c++) {
+            close(sockets[c]);
+        }
+        return failures == 0 ? 0 : EXIT_FAILURE;
+    }
+
+    // Upload mode: store a key file on the server as a pad
+    if ((argc == 5 || argc == 6) && strcmp(argv[1], "-u") == 0) {
+        if (argc == 6) {
+            strncpy(hostname, argv[5], sizeof(hostname) - 1);
+        }
+        struct inputFile pad;
+        if (openInputFile(argv[3], 0, &pad) < 0) {
+            exit(EXIT_FAILURE);
+        }
+        int socketFD = connectToServer(argv[4], hostname);
+        uploadPad(socketFD, argv[2], &pad);
+        close(socketFD);
+        return 0;
+    }
+
     // Validate the number of arguments
-    if (argc < 4) {
-        fprintf(stderr, "USAGE: %s ciphertext_file key_file port [hostname]\n", argv[0]);
+    if (argc < 4 || strcmp(argv[1], "-k") == 0) { // Batch options that did not parse
+        fprintf(stderr, "USAGE: %s [-p|-b] [-s] ciphertext_file key_file port [hostname]\n", argv[0]);
+        fprintf(stderr, "       %s [-p|-b] [-s] ciphertext_file @pad_id:offset port [hostname]\n", argv[0]);
+        fprintf(stderr, "       %s [-p|-b] [-s] -k [-j conns] [-n requests] [-o out_dir] port [hostname] < list_of_ciphertext_and_key_files\n", argv[0]);
+        fprintf(stderr, "       %s [-p|-b] [-s] -k [-j conns] [-n requests] -d ciphertext_dir -K key_dir -o out_dir port [hostname]\n", argv[0]);
+        fprintf(stderr, "       %s [-p] -u pad_id key_file port [hostname]\n", argv[0]);
+        fprintf(stderr, "       %s [-b] ciphertext_file key_file %s\n", argv[0], OTP_IN_PROCESS);
         exit(EXIT_FAILURE);
     }
 
-    int socketFD, portNumber;
-    struct sockaddr_in serverAddress;
-    char buffer[BUFFER_SIZE], ciphertext[BUFFER_SIZE], key[BUFFER_SIZE], response[BUFFER_SIZE];
-    char hostname[100] = "localhost"; // Default hostname is "localhost"
-
-    portNumber = atoi(argv[3]); // Convert the port number argument to an integer
+    struct inputFile ciphertext, key;
+    const char* port = argv[3]; // Port number, or the path of the server's local socket
 
     // If a hostname is provided, copy it to the `hostname` variable
     if (argc >= 5) {
         strncpy(hostname, argv[4], sizeof(hostname) - 1);
     }
 
-    // Read the ciphertext file into the `ciphertext` buffer
-    readFileContent(argv[1], ciphertext, BUFFER_SIZE);
-
-    // Read the key file into the `key` buffer
-    readFileContent(argv[2], key, BUFFER_SIZE);
-
-    // Validate that the key is long enough to decrypt the ciphertext
-    if (strlen(key) < strlen(ciphertext)) {
-        fprintf(stderr, "CLIENT: ERROR - Key too short to match ciphertext\n");
+    // Open the ciphertext file; trailing spaces are real symbols, so only newlines are trimmed
+    if (openInputFile(argv[1], 0, &ciphertext) < 0) {
         exit(EXIT_FAILURE);
     }
 
-    // Create the socket
-    socketFD = socket(AF_INET, SOCK_STREAM, 0);
-    if (socketFD < 0) {
-        error("CLIENT: ERROR opening socket");
+    // A key held by the server is named by pad ID and offset; only the ciphertext is sent
+    struct otpPadRef pad;
+    if (argv[2][0] == '@') {
+        if (parsePadReference(argv[2], &pad) < 0) {
+            fprintf(stderr, "CLIENT: ERROR - bad pad reference %s (expected @pad_id:offset)\n", argv[2]);
+            exit(EXIT_FAILURE);
+        }
+        int socketFD = connectToServer(port, hostname);
+        streamPadRequest(socketFD, OTP_OP_DECRYPT, &ciphertext, &pad, NULL, stdout);
+        close(socketFD);
+        return 0;
     }
 
-    // Set up the server address structure
-    setupAddressStruct(&serverAddress, portNumber, hostname);
-
-    // Connect to the server
-    if (connect(socketFD, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
-        error("CLIENT: ERROR connecting");
+    // Open the key file
+    if (openInputFile(argv[2], 0, &key) < 0) {
+        exit(EXIT_FAILURE);
     }
 
-    // Prepare the message to send in the format "ciphertext@key"
-    snprintf(buffer, BUFFER_SIZE - 1, "%s@%s", ciphertext, key);
-
-    // Send the message to the server
-    if (send(socketFD, buffer, strlen(buffer), 0) < 0) {
-        error("CLIENT: ERROR writing to socket");
+    // Validate that the key is long enough to decrypt the ciphertext
+    if (key.length < ciphertext.length) {
+        fprintf(stderr, "CLIENT: ERROR - Key too short to match ciphertext\n");
+        exit(EXIT_FAILURE);
     }
 
-    // Clear the response buffer
-    memset(response, '\0', BUFFER_SIZE);
-
-    // Receive the response from the server
-    if (recv(socketFD, response, BUFFER_SIZE - 1, 0) < 0) {
-        error("CLIENT: ERROR reading server response");
+    // No server: decrypt here with the same core the server runs
+    if (isInProcess(port)) {
+        runLocalRequest(OTP_OP_DECRYPT, &ciphertext, &key, NULL, stdout);
+        return 0;
     }
 
-    // Print the decrypted plaintext received from the server
-    printf("%s\n", response);
+    // Connect to the server
+    int socketFD = connectToServer(port, hostname);
+
+    // Stream ciphertext and key in segments, printing the decrypted plaintext as it arrives
+    streamRequest(socketFD, OTP_OP_DECRYPT, &ciphertext, &key, NULL, stdout);
 
     // Close the socket
     close(socketFD);
 
     return 0;
-}
\ No newline at end of file
+}
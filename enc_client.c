@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,9 +8,10 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
-#include <ctype.h>
 
-#define BUFFER_SIZE 100000 // Maximum buffer size for data transmission
+#include "otp_cipher.h"
+#include "otp_client_core.h"
+#include "otp_protocol.h"
 
 // Function to print error messages and exit the program
 void error(const char *msg) {
@@ -17,97 +19,204 @@ void error(const char *msg) {
     exit(EXIT_FAILURE); // Exit with failure status
 }
 
-// Function to read file content into a buffer and clean trailing newlines/spaces
-void readFileContent(const char *filename, char *buffer, size_t bufferSize) {
-    FILE *file = fopen(filename, "r"); // Open file in read mode
-    if (file == NULL) {
-        fprintf(stderr, "CLIENT: ERROR opening file %s\n", filename);
-        exit(EXIT_FAILURE);
-    }
-
-    // Read file content into buffer
-    if (fread(buffer, sizeof(char), bufferSize - 1, file) <= 0) {
-        fprintf(stderr, "CLIENT: ERROR reading file %s\n", filename);
-        exit(EXIT_FAILURE);
-    }
-
-    fclose(file); // Close the file
-
-    buffer[bufferSize - 1] = '\0'; // Null-terminate buffer
-
-    // Remove trailing newlines or spaces from buffer
-    while (strlen(buffer) > 0 && (buffer[strlen(buffer) - 1] == '\n' || buffer[strlen(buffer) - 1] == '\r' || buffer[strlen(buffer) - 1] == ' ')) {
-        buffer[strlen(buffer) - 1] = '\0';
-    }
-}
-
 // Function to validate plaintext for allowed characters (A-Z or space)
-void validatePlaintext(const char *plaintext) {
-    for (size_t i = 0; i < strlen(plaintext); ++i) {
+void validatePlaintext(const char *plaintext, size_t len) {
+    if (validateSymbols(plaintext, len) == 0) return; // Fast path: the whole segment is clean
+
+    for (size_t i = 0; i < len; ++i) {
         // Check for invalid characters
-        if (!isalpha(plaintext[i]) && plaintext[i] != ' ') {
+        if ((plaintext[i] < 'A' || plaintext[i] > 'Z') && plaintext[i] != ' ') {
             fprintf(stderr, "CLIENT: ERROR - invalid character in plaintext: '%c'\n", plaintext[i]);
             exit(EXIT_FAILURE);
         }
     }
 }
 
-int main(int argc, char *argv[]) {
-    // Ensure correct usage
-    if (argc < 4) {
-        fprintf(stderr, "USAGE: %s plaintext_file key_file port\n", argv[0]);
-        exit(EXIT_FAILURE);
-    }
-
-    int socketFD, portNumber; // File descriptor for the socket and port number
+// Function to connect to the encryption server on localhost, by port or local socket path
+int connectToServer(const char *port) {
     struct sockaddr_in serverAddress; // Server address structure
-    char buffer[BUFFER_SIZE], plaintext[BUFFER_SIZE], key[BUFFER_SIZE], response[BUFFER_SIZE];
-
-    portNumber = atoi(argv[3]); // Convert port argument to integer
 
-    // Read plaintext and key from files
-    readFileContent(argv[1], plaintext, BUFFER_SIZE);
-    readFileContent(argv[2], key, BUFFER_SIZE);
+    // A socket path skips the TCP loopback stack
+    if (isLocalAddress(port)) {
+        return connectLocalServer(port);
+    }
 
-    // Check if key length is sufficient for plaintext
-    if (strlen(key) < strlen(plaintext)) {
-        fprintf(stderr, "CLIENT: ERROR - Key too short to match plaintext\n");
+    // "local" runs single requests in this process; everything else needs a server
+    if (isInProcess(port)) {
+        fprintf(stderr, "CLIENT: ERROR - only plaintext_file key_file requests run %s\n", OTP_IN_PROCESS);
         exit(EXIT_FAILURE);
     }
 
-    validatePlaintext(plaintext); // Validate plaintext content
-
     // Create a socket
-    socketFD = socket(AF_INET, SOCK_STREAM, 0);
+    int socketFD = socket(AF_INET, SOCK_STREAM, 0);
     if (socketFD < 0) error("Error opening socket");
 
     // Setup server address structure
     memset(&serverAddress, 0, sizeof(serverAddress));
     serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons(portNumber); // Convert port number to network byte order
+    serverAddress.sin_port = htons(atoi(port)); // Convert port number to network byte order
     serverAddress.sin_addr.s_addr = inet_addr("127.0.0.1"); // Use localhost
 
     // Connect to the server
     if (connect(socketFD, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) < 0) {
         error("Error connecting to server");
     }
+    return socketFD;
+}
 
-    // Prepare plaintext and key for sending
-    snprintf(buffer, BUFFER_SIZE, "%s@%s", plaintext, key);
+// Function to read "[-e|-d] plaintext_file key_file [output_file]" lines from stdin into a request list
+struct clientRequest *readRequestList(const char *outDir, size_t *count) {
+    struct clientRequest *requests = NULL;
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t lineSize = 0;
+
+    *count = 0;
+    while (getline(&line, &lineSize, stdin) > 0) {
+        char *textFile = strtok(line, " \t\r\n");
+        uint8_t op = 0; // This client's own operation
+        if (textFile != NULL && (strcmp(textFile, "-e") == 0 || strcmp(textFile, "-d") == 0)) {
+            // "-e" or "-d" first: encrypt or decrypt this one, for a combined otp_server
+            op = textFile[1] == 'e' ? OTP_OP_ENCRYPT : OTP_OP_DECRYPT;
+            textFile = strtok(NULL, " \t\r\n");
+        }
+        char *keyFile = strtok(NULL, " \t\r\n");
+        char *outFile = strtok(NULL, " \t\r\n");
+        if (textFile == NULL) continue; // Skip blank lines
+        if (keyFile == NULL) {
+            fprintf(stderr, "CLIENT: ERROR - expected \"plaintext_file key_file\" but got \"%s\"\n", textFile);
+            exit(EXIT_FAILURE);
+        }
 
-    // Send data to the server
-    if (send(socketFD, buffer, strlen(buffer), 0) < 0) {
-        error("Error sending data");
+        if (*count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            requests = realloc(requests, capacity * sizeof(*requests));
+            if (requests == NULL) error("CLIENT: ERROR allocating request list");
+        }
+        requests[*count].op = op;
+        requests[*count].textFile = strdup(textFile);
+        requests[*count].keyFile = strdup(keyFile);
+        if (outFile != NULL) {
+            requests[*count].outFile = strdup(outFile);
+        } else {
+            // Without an output directory, ciphertexts go to stdout one line each
+            requests[*count].outFile = outDir != NULL ? batchOutputPath(outDir, textFile) : NULL;
+        }
+        requests[*count].out = stdout;
+        (*count)++;
     }
+    free(line);
+    return requests;
+}
 
-    // Receive response from server
-    memset(response, '\0', BUFFER_SIZE);
-    if (recv(socketFD, response, BUFFER_SIZE, 0) < 0) {
-        error("Error receiving server response");
+int main(int argc, char *argv[]) {
+    // Packed mode (-p): any of the forms below, sending text and key 5 symbols to 3 bytes.
+    // Shared mode (-s): text and key go through shared memory (needs a socket path as the port).
+    // Binary mode (-b): any bytes, combined with XOR against a binary key
+    while (argc > 1 && (strcmp(argv[1], "-p") == 0 || strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "-b") == 0)) {
+        if (argv[1][1] == 'p') usePackedEncoding();
+        else if (argv[1][1] == 'b') useBinaryMode();
+        else useSharedMemory();
+        argv[1] = argv[0]; // Drop the option and parse the rest as usual
+        argv++;
+        argc--;
     }
 
-    printf("%s\n", response); // Print the server response
+    // Batch mode: pipeline every request listed on stdin, or every file of a directory,
+    // over keep-alive connections
+    struct batchOptions batch;
+    int next;
+    if (argc >= 3 && strcmp(argv[1], "-k") == 0 &&
+        (next = parseBatchOptions(argc - 1, argv + 1, &batch)) == argc - 2) {
+        size_t count;
+        struct clientRequest *requests = batch.textDir != NULL ? listBatchDirectory(&batch, &count)
+                                                               : readRequestList(batch.outDir, &count);
+        for (size_t i = 0; i < count && batch.connections > 1; i++) {
+            if (requests[i].outFile == NULL) {
+                fprintf(stderr, "CLIENT: ERROR - -j needs an output file for every request (use -o)\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        int sockets[batch.connections];
+        for (int c = 0; c < batch.connections; c++) {
+            sockets[c] = connectToServer(argv[argc - 1]);
+        }
+        size_t failures = runBatch(sockets, batch.connections, OTP_OP_ENCRYPT, 1, batch.maxInFlight,
+                                   requests, count);
+        for (int c = 0; c < batch.connections; c++) {
+            close(sockets[c]);
+        }
+        return failures == 0 ? 0 : EXIT_FAILURE;
+    }
+
+    // Upload mode: store a key file on the server as a pad; trailing spaces are key symbols
+    if (argc == 5 && strcmp(argv[1], "-u") == 0) {
+        struct inputFile pad;
+        if (openInputFile(argv[3], 0, &pad) < 0) {
+            exit(EXIT_FAILURE);
+        }
+        int socketFD = connectToServer(argv[4]);
+        uploadPad(socketFD, argv[2], &pad);
+        close(socketFD);
+        return 0;
+    }
+
+    // Ensure correct usage
+    if (argc < 4 || strcmp(argv[1], "-k") == 0) { // Batch options that did not parse
+        fprintf(stderr, "USAGE: %s [-p|-b] [-s] plaintext_file key_file port\n", argv[0]);
+        fprintf(stderr, "       %s [-p|-b] [-s] plaintext_file @pad_id:offset port\n", argv[0]);
+        fprintf(stderr, "       %s [-p|-b] [-s] plaintext_file %%pool_name:key_file port\n", argv[0]);
+        fprintf(stderr, "       %s [-p|-b] [-s] -k [-j conns] [-n requests] [-o out_dir] port < list_of_plaintext_and_key_files\n", argv[0]);
+        fprintf(stderr, "       %s [-p|-b] [-s] -k [-j conns] [-n requests] -d plaintext_dir -K key_dir -o out_dir port\n", argv[0]);
+        fprintf(stderr, "       %s [-p] -u pad_id key_file port\n", argv[0]);
+        fprintf(stderr, "       %s [-b] plaintext_file key_file|%%pool_name:key_file %s\n", argv[0], OTP_IN_PROCESS);
+        exit(EXIT_FAILURE);
+    }
+
+    struct inputFile plaintext, key;
+    const char *port = argv[3]; // Port number or local socket path
+
+    // Open the plaintext file, trimming trailing newlines/spaces
+    if (openInputFile(argv[1], 1, &plaintext) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Key held by the server: send the plaintext alone
+    struct otpPadRef pad;
+    if (argv[2][0] == '@') {
+        if (parsePadReference(argv[2], &pad) < 0) {
+            fprintf(stderr, "CLIENT: ERROR - bad pad reference %s (expected @pad_id:offset)\n", argv[2]);
+            exit(EXIT_FAILURE);
+        }
+        int socketFD = connectToServer(port);
+        streamPadRequest(socketFD, OTP_OP_ENCRYPT, &plaintext, &pad, validatePlaintext, stdout);
+        close(socketFD);
+        return 0;
+    }
+
+    // Take a fresh key from a key pool, saving it for decryption, or open the key file,
+    // trimming trailing newlines/spaces
+    if (argv[2][0] == '%' ? takePoolKey(argv[2], plaintext.length, &key) < 0 : openInputFile(argv[2], 1, &key) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Check if key length is sufficient for plaintext
+    if (key.length < plaintext.length) {
+        fprintf(stderr, "CLIENT: ERROR - Key too short to match plaintext\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // No server: encrypt here with the same core the server runs
+    if (isInProcess(port)) {
+        runLocalRequest(OTP_OP_ENCRYPT, &plaintext, &key, validatePlaintext, stdout);
+        return 0;
+    }
+
+    int socketFD = connectToServer(port);
+
+    // Stream plaintext and key in segments, printing ciphertext as it arrives
+    streamRequest(socketFD, OTP_OP_ENCRYPT, &plaintext, &key, validatePlaintext, stdout);
 
     close(socketFD); // Close the socket
     return 0;
-}
\ No newline at end of file
+}
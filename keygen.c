@@ -1,38 +1,263 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
+#include <sys/random.h>
+#include <unistd.h>
 
-// Function to generate a random character (A-Z or space)
-char generate_random_char() {
-    int rand_value = rand() % 27;
-    return (rand_value == 26) ? ' ' : 'A' + rand_value;
+#include "otp_keypool.h"
+
+#define BLOCK_SIZE (1 << 20) // Key bytes produced per write
+#define THREAD_THRESHOLD (8u << 20) // Keys shorter than this are generated on one thread
+#define ACCEPT_LIMIT 243 // Largest multiple of 27 that fits in a byte (27 * 9)
+#define POOL_IDLE_US 1000 // How often a full key pool is checked for room
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static char symbol_for[256]; // Random byte -> key character, for bytes below ACCEPT_LIMIT
+static int binary; // -b: raw random bytes for binary mode, no newline
+static volatile sig_atomic_t stopping; // -P: asked to shut the pool down
+
+struct worker {
+    uint64_t quota; // Key bytes this thread must produce
+    int failed;
+};
+
+// Fill buffer with random bytes from the kernel CSPRNG
+static int fill_random(unsigned char *buffer, size_t len) {
+    static int urandom = -1;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n;
+        if (urandom < 0) {
+            n = getrandom(buffer + done, len - done, 0);
+            if (n < 0 && errno == ENOSYS) {
+                // Kernel predates getrandom(): fall back to the device
+                pthread_mutex_lock(&output_lock);
+                if (urandom < 0) urandom = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+                pthread_mutex_unlock(&output_lock);
+                if (urandom < 0) return -1;
+                continue;
+            }
+        } else {
+            n = read(urandom, buffer + done, len - done);
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+// Write a whole block to stdout. Blocks are independent and uniformly random,
+// so the order in which threads emit them does not matter
+static int write_block(const char *block, size_t len) {
+    int status = 0;
+    pthread_mutex_lock(&output_lock);
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, block, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            status = -1;
+            break;
+        }
+        block += n;
+        len -= (size_t)n;
+    }
+    pthread_mutex_unlock(&output_lock);
+    return status;
+}
+
+// Fill block with want random key characters (A-Z or space), or random bytes in binary
+// mode, using random (BLOCK_SIZE bytes) as scratch.
+// Bytes >= 243 are rejected so that every symbol is equally likely (rand() % 27 was not)
+static int fill_key(char *block, size_t want, unsigned char *random) {
+    if (binary) {
+        // Every byte value is a key symbol, so nothing is rejected
+        return fill_random((unsigned char *)block, want);
+    }
+    size_t have = 0;
+    while (have < want) {
+        // About 5% of bytes are rejected, so ask for a little more than we need
+        size_t request = (want - have) + (want - have) / 16 + 16;
+        if (request > BLOCK_SIZE) request = BLOCK_SIZE;
+        if (fill_random(random, request) < 0) {
+            return -1;
+        }
+        // Branch-free compaction: always store, only advance past accepted bytes
+        for (size_t i = 0; i < request; i++) {
+            block[have] = symbol_for[random[i]];
+            have += random[i] < ACCEPT_LIMIT;
+            if (have == want) break;
+        }
+    }
+    return 0;
+}
+
+// Generate quota key characters in large blocks and write them out
+static void *generate_key(void *arg) {
+    struct worker *worker = arg;
+    unsigned char *random = malloc(BLOCK_SIZE);
+    char *block = malloc(BLOCK_SIZE);
+
+    if (random == NULL || block == NULL) {
+        worker->failed = 1;
+        free(random);
+        free(block);
+        return NULL;
+    }
+
+    uint64_t remaining = worker->quota;
+    while (remaining > 0) {
+        size_t want = remaining < BLOCK_SIZE ? (size_t)remaining : BLOCK_SIZE;
+        if (fill_key(block, want, random) < 0 || write_block(block, want) < 0) {
+            worker->failed = 1;
+            break;
+        }
+        remaining -= want;
+    }
+
+    free(random);
+    free(block);
+    return NULL;
+}
+
+static void stop_pool(int signal) {
+    (void)signal;
+    stopping = 1;
+}
+
+// -P: keep the shared-memory key pool `name` full until interrupted, generating
+// straight into the ring whenever clients have taken from it
+static int serve_pool(const char *name, uint64_t capacity) {
+    unsigned char *random = malloc(BLOCK_SIZE);
+    struct keyPool *pool = createKeyPool(name, capacity, binary);
+    if (random == NULL || pool == NULL) {
+        fprintf(stderr, "Error: cannot create key pool %s\n", name);
+        return 1;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_pool;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int status = 0;
+    while (!stopping) {
+        size_t len = BLOCK_SIZE;
+        char *space = keyPoolSpace(pool, &len);
+        if (len == 0) {
+            usleep(POOL_IDLE_US);
+            continue;
+        }
+        if (fill_key(space, len, random) < 0) {
+            fprintf(stderr, "Error: could not generate key\n");
+            status = 1;
+            break;
+        }
+        keyPoolFilled(pool, len);
+    }
+    removeKeyPool(name);
+    free(random);
+    return status;
 }
 
 int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        binary = 1;
+        argv[1] = argv[0]; // Parse the rest as usual
+        argv++;
+        argc--;
+    }
+
+    // Pool mode (-P name size): serve a shared-memory key pool instead of writing a key
+    const char *pool_name = NULL;
+    if (argc == 4 && strcmp(argv[1], "-P") == 0) {
+        pool_name = argv[2];
+        argv[2] = argv[0]; // Parse the size like a key length
+        argv += 2;
+        argc -= 2;
+    }
+
     // Ensure the program is called with the correct number of arguments
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s keylength\n", argv[0]);
+    if (argc != 2 && (argc != 3 || pool_name != NULL)) {
+        fprintf(stderr, "Usage: %s [-b] keylength [threads]\n", argv[0]);
+        fprintf(stderr, "       %s [-b] -P pool_name pool_size\n", argv[0]);
         return 1;
     }
 
     // Parse the key length and validate it
-    int key_length = atoi(argv[1]);
-    if (key_length <= 0) {
+    char *end;
+    errno = 0;
+    unsigned long long key_length = strtoull(argv[1], &end, 10);
+    if (errno != 0 || *end != '\0' || argv[1][0] == '-' || key_length == 0) {
         fprintf(stderr, "Error: keylength must be a positive integer\n");
         return 1;
     }
 
-    // Seed the random number generator
-    srand(time(NULL));
+    // Byte b maps to symbol b % 27, with 26 standing for a space
+    for (int b = 0; b < 256; b++) {
+        int value = b % 27;
+        symbol_for[b] = (value == 26) ? ' ' : 'A' + value;
+    }
 
-    // Generate and output the random key
-    for (int i = 0; i < key_length; i++) {
-        putchar(generate_random_char());
+    if (pool_name != NULL) {
+        return serve_pool(pool_name, key_length);
     }
 
-    // Output a newline character and ensure all output is flushed
-    putchar('\n');
-    fflush(stdout); // Explicitly flush stdout to avoid buffering issues
+    // One thread per CPU for large pads unless told otherwise
+    long threads = 1;
+    if (argc == 3) {
+        threads = strtol(argv[2], &end, 10);
+        if (*end != '\0' || threads <= 0) {
+            fprintf(stderr, "Error: threads must be a positive integer\n");
+            return 1;
+        }
+    } else if (key_length >= THREAD_THRESHOLD) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 1) threads = 1;
+    }
+    if ((unsigned long long)threads > key_length / BLOCK_SIZE + 1) {
+        threads = (long)(key_length / BLOCK_SIZE + 1); // No point in threads without a block to do
+    }
+
+    // Split the key between the threads and generate it
+    struct worker *workers = calloc((size_t)threads, sizeof(*workers));
+    pthread_t *ids = calloc((size_t)threads, sizeof(*ids));
+    if (workers == NULL || ids == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    for (long i = 0; i < threads; i++) {
+        workers[i].quota = key_length / threads + ((unsigned long long)i < key_length % threads ? 1 : 0);
+        if (i > 0 && pthread_create(&ids[i], NULL, generate_key, &workers[i]) != 0) {
+            fprintf(stderr, "Error: cannot start worker thread\n");
+            return 1;
+        }
+    }
+    generate_key(&workers[0]); // The main thread does its share too
+    for (long i = 1; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+
+    for (long i = 0; i < threads; i++) {
+        if (workers[i].failed) {
+            fprintf(stderr, "Error: could not generate key\n");
+            return 1;
+        }
+    }
+
+    // Output a newline character to end the key (a binary key is all key bytes)
+    if (!binary && write_block("\n", 1) < 0) {
+        fprintf(stderr, "Error: could not write key\n");
+        return 1;
+    }
 
+    free(workers);
+    free(ids);
     return 0;
 }
@@ -0,0 +1,351 @@
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "otp_client_core.h"
+#include "otp_protocol.h"
+
+/*
+ * Load generator for enc_server and dec_server.
+ *
+ * Every connection runs on its own thread in a closed loop: send a request of
+ * a size drawn from the chosen distribution, read the whole reply, record the
+ * latency, repeat. Requests that finish during the warmup or after the end of
+ * the measured window are not counted.
+ */
+
+enum sizeShape { SIZE_FIXED, SIZE_UNIFORM, SIZE_LOG_UNIFORM };
+
+struct benchConfig {
+    const char *host;
+    int port;
+    int connections;
+    double duration, warmup;  // Seconds
+    uint8_t op;               // 0: a random mix of both, for a combined otp_server
+    int reconnect;            // New connection per request instead of keep-alive
+    enum sizeShape shape;
+    uint64_t minSize, maxSize;
+};
+
+struct benchWorker {
+    pthread_t thread;
+    uint64_t seed;
+    uint64_t requests, errors, shed, bytes;
+    uint64_t *latencies;      // Nanoseconds, one per counted request
+    size_t latencyCount, latencyCapacity;
+};
+
+static struct benchConfig bench;
+static char *textData, *keyData; // Shared read-only message material, maxSize symbols each
+static uint64_t windowStart, windowEnd; // Measured window, CLOCK_MONOTONIC nanoseconds
+static int stopping;
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*: cheap per-thread randomness for sizes and offsets
+static uint64_t nextRandom(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Dull;
+}
+
+static double randomUnit(uint64_t *state) {
+    return (double)(nextRandom(state) >> 11) / 9007199254740992.0; // [0, 1)
+}
+
+static uint64_t pickSize(uint64_t *state) {
+    switch (bench.shape) {
+    case SIZE_UNIFORM:
+        return bench.minSize + nextRandom(state) % (bench.maxSize - bench.minSize + 1);
+    case SIZE_LOG_UNIFORM: {
+        // Many small messages and a long tail of large ones
+        double low = (double)bench.minSize, high = (double)bench.maxSize + 1;
+        uint64_t size = (uint64_t)(low * exp(randomUnit(state) * log(high / low)));
+        return size > bench.maxSize ? bench.maxSize : size;
+    }
+    default:
+        return bench.minSize;
+    }
+}
+
+static int connectToServer(void) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(bench.port);
+    if (inet_pton(AF_INET, bench.host, &address.sin_addr) != 1) {
+        fprintf(stderr, "BENCH: ERROR - bad address %s\n", bench.host);
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+// Read one reply frame. Returns its type (and error code), or -1 if the connection failed
+static int readFrame(int fd, char *payload, uint64_t *dataBytes, uint8_t *code) {
+    unsigned char header[OTP_FRAME_HEADER_SIZE];
+    struct otpFrameHeader frame;
+    if (recvAll(fd, header, sizeof(header)) != sizeof(header)) return -1;
+    decodeFrameHeader(header, &frame);
+    if (frame.length > OTP_CHUNK_SIZE) return -1;
+    if (frame.length > 0 && recvAll(fd, payload, frame.length) != (ssize_t)frame.length) return -1;
+    if (frame.type == OTP_FRAME_DATA) *dataBytes += frame.length;
+    *code = frame.code;
+    return frame.type;
+}
+
+// Send one request of `size` symbols and read its reply, keeping at most
+// OTP_REQUEST_WINDOW reply bytes outstanding like the real clients do.
+// Returns 0 on success, 1 if the server answered with an error, 2 if it shed the
+// request under load, -1 if the connection failed
+static int runRequest(int fd, uint64_t size, uint64_t *state, char *payload) {
+    unsigned char header[OTP_REQUEST_HEADER_SIZE];
+    uint8_t flags = bench.reconnect ? 0 : OTP_FLAG_KEEPALIVE;
+    uint8_t op = bench.op != 0 ? bench.op : (nextRandom(state) & 1) ? OTP_OP_ENCRYPT : OTP_OP_DECRYPT;
+    struct otpRequestHeader request = { op, flags, size, size };
+    encodeRequestHeader(&request, header);
+    if (sendAll(fd, header, sizeof(header)) < 0) return -1;
+
+    uint64_t sent = 0, answered = 0;
+    int type = OTP_FRAME_DATA;
+    uint8_t code = 0;
+    while (sent < size) {
+        size_t n = size - sent < OTP_CHUNK_SIZE ? (size_t)(size - sent) : OTP_CHUNK_SIZE;
+        while (type == OTP_FRAME_DATA && sent > answered && sent - answered + n > OTP_REQUEST_WINDOW) {
+            type = readFrame(fd, payload, &answered, &code);
+            if (type < 0) return -1;
+        }
+        // Any window of the shared material is a valid message
+        size_t offset = (size_t)(nextRandom(state) % (bench.maxSize - n + 1));
+        if (sendSegment(fd, textData + offset, keyData + offset, n) < 0) return -1;
+        sent += n;
+    }
+    while (type == OTP_FRAME_DATA) {
+        type = readFrame(fd, payload, &answered, &code);
+        if (type < 0) return -1;
+    }
+    return type == OTP_FRAME_END ? 0 : code == OTP_ERROR_OVERLOADED ? 2 : 1;
+}
+
+static void recordLatency(struct benchWorker *worker, uint64_t latency) {
+    if (worker->latencyCount == worker->latencyCapacity) {
+        size_t capacity = worker->latencyCapacity ? 2 * worker->latencyCapacity : 4096;
+        uint64_t *latencies = realloc(worker->latencies, capacity * sizeof(*latencies));
+        if (latencies == NULL) {
+            fprintf(stderr, "BENCH: ERROR out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        worker->latencies = latencies;
+        worker->latencyCapacity = capacity;
+    }
+    worker->latencies[worker->latencyCount++] = latency;
+}
+
+static void *runWorker(void *arg) {
+    struct benchWorker *worker = arg;
+    char *payload = malloc(OTP_CHUNK_SIZE);
+    int fd = -1;
+    if (payload == NULL) {
+        fprintf(stderr, "BENCH: ERROR out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        uint64_t size = pickSize(&worker->seed);
+        uint64_t start = now();
+        int status = -1;
+        if (fd < 0) fd = connectToServer();
+        if (fd >= 0) status = runRequest(fd, size, &worker->seed, payload);
+        uint64_t end = now();
+
+        if (status != 0 || bench.reconnect) {
+            if (fd >= 0) close(fd);
+            fd = -1; // A failed keep-alive connection may be out of step; start over
+        }
+        if (start < windowStart || end > windowEnd) {
+            if (status < 0 && end <= windowEnd) usleep(1000); // Don't spin on a server that is down
+            continue;
+        }
+        if (status == 0) {
+            worker->requests++;
+            worker->bytes += size;
+            recordLatency(worker, end - start);
+        } else if (status == 2) {
+            worker->shed++;
+        } else {
+            worker->errors++;
+            if (status < 0) usleep(1000);
+        }
+    }
+    if (fd >= 0) close(fd);
+    free(payload);
+    return NULL;
+}
+
+static int compareLatency(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const uint64_t *sorted, size_t count, double fraction) {
+    if (count == 0) return 0;
+    size_t index = (size_t)(fraction * (double)count);
+    if (index >= count) index = count - 1;
+    return (double)sorted[index] / 1000.0; // Microseconds
+}
+
+// Parse "N", "MIN-MAX" or "MIN-MAX:log"
+static int parseSizes(const char *spec) {
+    char *end;
+    bench.minSize = strtoull(spec, &end, 10);
+    bench.maxSize = bench.minSize;
+    bench.shape = SIZE_FIXED;
+    if (*end == '-') {
+        bench.maxSize = strtoull(end + 1, &end, 10);
+        bench.shape = SIZE_UNIFORM;
+        if (strcmp(end, ":log") == 0) {
+            bench.shape = SIZE_LOG_UNIFORM;
+            end += 4;
+        }
+    }
+    return (*end == '\0' && bench.minSize > 0 && bench.maxSize >= bench.minSize) ? 0 : -1;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "USAGE: %s -p port [-h host] [-c connections] [-d seconds] [-w warmup_seconds]\n", program);
+    fprintf(stderr, "       %*s [-s size|min-max|min-max:log] [-o enc|dec|mixed] [-n]\n", (int)strlen(program), "");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    bench.host = "127.0.0.1";
+    bench.connections = 16;
+    bench.duration = 10;
+    bench.warmup = 1;
+    bench.op = OTP_OP_ENCRYPT;
+    const char *sizes = "1024";
+
+    int option;
+    while ((option = getopt(argc, argv, "p:h:c:d:w:s:o:n")) != -1) {
+        switch (option) {
+        case 'p': bench.port = atoi(optarg); break;
+        case 'h': bench.host = optarg; break;
+        case 'c': bench.connections = atoi(optarg); break;
+        case 'd': bench.duration = atof(optarg); break;
+        case 'w': bench.warmup = atof(optarg); break;
+        case 's': sizes = optarg; break;
+        case 'o':
+            if (strcmp(optarg, "enc") == 0) bench.op = OTP_OP_ENCRYPT;
+            else if (strcmp(optarg, "dec") == 0) bench.op = OTP_OP_DECRYPT;
+            else if (strcmp(optarg, "mixed") == 0) bench.op = 0;
+            else usage(argv[0]);
+            break;
+        case 'n': bench.reconnect = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (bench.port <= 0 || bench.connections <= 0 || bench.duration <= 0 || bench.warmup < 0 ||
+        optind != argc || parseSizes(sizes) < 0) {
+        usage(argv[0]);
+    }
+
+    // Random symbols; any text is valid ciphertext too, so both servers accept it
+    uint64_t seed = now() | 1;
+    textData = malloc(bench.maxSize);
+    keyData = malloc(bench.maxSize);
+    if (textData == NULL || keyData == NULL) {
+        fprintf(stderr, "BENCH: ERROR out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (uint64_t i = 0; i < bench.maxSize; i++) {
+        int t = (int)(nextRandom(&seed) % 27), k = (int)(nextRandom(&seed) % 27);
+        textData[i] = t == 26 ? ' ' : 'A' + t;
+        keyData[i] = k == 26 ? ' ' : 'A' + k;
+    }
+
+    struct benchWorker *workers = calloc((size_t)bench.connections, sizeof(*workers));
+    if (workers == NULL) {
+        fprintf(stderr, "BENCH: ERROR out of memory\n");
+        return EXIT_FAILURE;
+    }
+    windowStart = now() + (uint64_t)(bench.warmup * 1e9);
+    windowEnd = windowStart + (uint64_t)(bench.duration * 1e9);
+    for (int i = 0; i < bench.connections; i++) {
+        workers[i].seed = nextRandom(&seed) | 1;
+        if (pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]) != 0) {
+            fprintf(stderr, "BENCH: ERROR cannot start connection thread %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint64_t current;
+    while ((current = now()) < windowEnd) {
+        uint64_t left = windowEnd - current;
+        struct timespec pause = { (time_t)(left / 1000000000u), (long)(left % 1000000000u) };
+        nanosleep(&pause, NULL);
+    }
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+
+    // Merge the per-connection results
+    uint64_t requests = 0, errors = 0, shed = 0, bytes = 0;
+    size_t count = 0;
+    for (int i = 0; i < bench.connections; i++) {
+        pthread_join(workers[i].thread, NULL);
+        requests += workers[i].requests;
+        errors += workers[i].errors;
+        shed += workers[i].shed;
+        bytes += workers[i].bytes;
+        count += workers[i].latencyCount;
+    }
+    uint64_t *latencies = malloc((count > 0 ? count : 1) * sizeof(*latencies));
+    if (latencies == NULL) {
+        fprintf(stderr, "BENCH: ERROR out of memory\n");
+        return EXIT_FAILURE;
+    }
+    size_t filled = 0;
+    for (int i = 0; i < bench.connections; i++) {
+        memcpy(latencies + filled, workers[i].latencies, workers[i].latencyCount * sizeof(*latencies));
+        filled += workers[i].latencyCount;
+        free(workers[i].latencies);
+    }
+    qsort(latencies, count, sizeof(*latencies), compareLatency);
+
+    printf("%s:%d %s, %d connections%s, sizes %s, %.1fs\n", bench.host, bench.port,
+           bench.op == OTP_OP_ENCRYPT ? "encrypt" : bench.op == OTP_OP_DECRYPT ? "decrypt" : "mixed", bench.connections,
+           bench.reconnect ? " (new connection per request)" : "", sizes, bench.duration);
+    printf("requests     %llu (%llu errors, %llu shed)\n", (unsigned long long)requests, (unsigned long long)errors,
+           (unsigned long long)shed);
+    printf("throughput   %.1f req/s  %.2f MB/s\n", (double)requests / bench.duration,
+           (double)bytes / bench.duration / 1e6);
+    printf("latency us   p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n", percentile(latencies, count, 0.50),
+           percentile(latencies, count, 0.99), percentile(latencies, count, 0.999),
+           count > 0 ? (double)latencies[count - 1] / 1000.0 : 0.0);
+
+    free(latencies);
+    free(workers);
+    free(textData);
+    free(keyData);
+    return errors == 0 ? 0 : EXIT_FAILURE;
+}
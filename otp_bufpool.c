@@ -0,0 +1,72 @@
+#include <stdlib.h>
+
+#include "otp_bufpool.h"
+
+#define MIN_SHIFT 8 // Smallest class: 256 bytes, room for the free list link
+#define CLASSES (2 * (18 - MIN_SHIFT) + 1) // Up to 1 << 18, BUFPOOL_MAX_SIZE
+
+struct freeBuffer {
+    struct freeBuffer *next;
+};
+
+static struct freeBuffer *freeLists[CLASSES];
+static size_t idleBytes;
+static size_t idleLimit = BUFPOOL_DEFAULT_LIMIT;
+
+static size_t classSize(int index) {
+    return (index & 1) ? (size_t)3 << (MIN_SHIFT - 1 + index / 2) : (size_t)1 << (MIN_SHIFT + index / 2);
+}
+
+// Smallest class holding size bytes, or -1 if none does
+static int classOf(size_t size) {
+    if (size <= ((size_t)1 << MIN_SHIFT)) return 0;
+    if (size > BUFPOOL_MAX_SIZE) return -1;
+    int k = 63 - __builtin_clzll((unsigned long long)(size - 1)); // 2^k < size <= 2^(k+1)
+    return size <= (size_t)3 << (k - 1) ? 2 * (k - MIN_SHIFT) + 1 : 2 * (k + 1 - MIN_SHIFT);
+}
+
+void *takeBuffer(size_t size, size_t *capacity) {
+    int index = classOf(size);
+    if (index < 0) {
+        *capacity = size;
+        return malloc(size);
+    }
+    *capacity = classSize(index);
+    struct freeBuffer *buffer = freeLists[index];
+    if (buffer != NULL) {
+        freeLists[index] = buffer->next;
+        idleBytes -= *capacity;
+        return buffer;
+    }
+    return malloc(*capacity);
+}
+
+void giveBuffer(void *buffer, size_t capacity) {
+    if (buffer == NULL) return;
+    int index = classOf(capacity);
+    if (index < 0 || classSize(index) != capacity || idleBytes + capacity > idleLimit) {
+        free(buffer);
+        return;
+    }
+    struct freeBuffer *entry = buffer;
+    entry->next = freeLists[index];
+    freeLists[index] = entry;
+    idleBytes += capacity;
+}
+
+void setBufferPoolLimit(size_t limit) {
+    idleLimit = limit;
+    // Largest buffers go first: they are the fewest to give back for the most memory
+    for (int index = CLASSES - 1; index >= 0 && idleBytes > idleLimit; index--) {
+        while (freeLists[index] != NULL && idleBytes > idleLimit) {
+            struct freeBuffer *buffer = freeLists[index];
+            freeLists[index] = buffer->next;
+            idleBytes -= classSize(index);
+            free(buffer);
+        }
+    }
+}
+
+size_t bufferPoolIdle(void) {
+    return idleBytes;
+}
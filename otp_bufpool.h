@@ -0,0 +1,35 @@
+#ifndef OTP_BUFPOOL_H
+#define OTP_BUFPOOL_H
+
+#include <stddef.h>
+
+/*
+ * Size-classed buffers for the segments and replies of requests.
+ *
+ * Classes run 256 B, 384 B, 512 B, 768 B, ... up to BUFPOOL_MAX_SIZE, so a
+ * buffer is never more than 1.5 times what was asked for. A buffer handed back
+ * goes on its class's free list for the next request rather than to malloc,
+ * which maps and unmaps anything this large on every call. At most the pool's
+ * limit of idle bytes is kept; the rest, and anything larger than the largest
+ * class, goes straight back to the system.
+ *
+ * One pool per process, used only from the event loop thread: workers write into
+ * buffers they are given but never take or return one.
+ */
+
+#define BUFPOOL_MAX_SIZE (256 * 1024)
+#define BUFPOOL_DEFAULT_LIMIT (32u << 20) // Idle bytes kept unless told otherwise
+
+// A buffer of at least size bytes, or NULL. *capacity is set to its real size,
+// all of which the caller may use; pass that back to giveBuffer
+void *takeBuffer(size_t size, size_t *capacity);
+
+void giveBuffer(void *buffer, size_t capacity);
+
+// Keep at most limit idle bytes, releasing any beyond that now
+void setBufferPoolLimit(size_t limit);
+
+// Bytes currently sitting idle in the pool
+size_t bufferPoolIdle(void);
+
+#endif
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "otp_bufpool.h"
+
+static int failures = 0;
+
+static void check(int condition, const char *what, size_t size, size_t got) {
+    if (!condition) {
+        fprintf(stderr, "FAIL %s (size %zu, got %zu)\n", what, size, got);
+        failures++;
+    }
+}
+
+// Each size lands in the smallest class holding it; past the largest class a
+// buffer is exactly what was asked for
+static void testClasses(void) {
+    static const size_t cases[][2] = {
+        { 1, 256 },           { 256, 256 },         { 257, 384 },         { 384, 384 },
+        { 385, 512 },         { 513, 768 },         { 769, 1024 },        { 65544, 98304 },
+        { 131072, 131072 },   { 131073, 196608 },   { 196608, 196608 },   { 196609, 262144 },
+        { 262144, 262144 },   { BUFPOOL_MAX_SIZE + 1, BUFPOOL_MAX_SIZE + 1 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        size_t capacity = 0;
+        void *buffer = takeBuffer(cases[i][0], &capacity);
+        check(buffer != NULL && capacity == cases[i][1], "class capacity", cases[i][0], capacity);
+        free(buffer); // Not back to the pool, which this test wants empty
+    }
+    check(bufferPoolIdle() == 0, "taking from an empty pool keeps nothing", 0, bufferPoolIdle());
+}
+
+// A buffer handed back serves the next request of its class and no other
+static void testReuse(void) {
+    size_t capacity, again, other;
+    void *buffer = takeBuffer(1000, &capacity);
+    giveBuffer(buffer, capacity);
+    check(bufferPoolIdle() == 1024, "given buffer kept", 1000, bufferPoolIdle());
+
+    void *larger = takeBuffer(1025, &other);
+    check(larger != buffer && bufferPoolIdle() == 1024, "next class not served from it", 1025, other);
+    void *reused = takeBuffer(769, &again);
+    check(reused == buffer && again == 1024, "same class reused", 769, again);
+    check(bufferPoolIdle() == 0, "reused buffer no longer idle", 769, bufferPoolIdle());
+    giveBuffer(reused, again);
+    giveBuffer(larger, other);
+    check(bufferPoolIdle() == 1024 + 1536, "both kept", 0, bufferPoolIdle());
+
+    // Neither a capacity between classes nor one past the largest is kept
+    giveBuffer(malloc(300), 300);
+    void *huge = takeBuffer(BUFPOOL_MAX_SIZE + 1, &capacity);
+    giveBuffer(huge, capacity);
+    giveBuffer(NULL, 256);
+    check(bufferPoolIdle() == 1024 + 1536, "odd sizes freed", 300, bufferPoolIdle());
+    setBufferPoolLimit(0);
+}
+
+// Idle bytes never pass the limit, and lowering it frees the largest buffers first
+static void testLimit(void) {
+    size_t small, medium, large, extra;
+    void *a = takeBuffer(1024, &small);
+    void *b = takeBuffer(1024, &small);
+    void *c = takeBuffer(1536, &medium);
+    void *d = takeBuffer(2048, &large);
+    void *e = takeBuffer(1024, &extra);
+
+    setBufferPoolLimit(4096);
+    giveBuffer(d, large);
+    giveBuffer(a, small);
+    giveBuffer(c, medium); // 4608 would pass the limit
+    check(bufferPoolIdle() == 3072, "buffer past the limit freed", medium, bufferPoolIdle());
+    giveBuffer(b, small);
+    check(bufferPoolIdle() == 4096, "buffer up to the limit kept", small, bufferPoolIdle());
+    giveBuffer(e, extra);
+    check(bufferPoolIdle() == 4096, "full pool frees", extra, bufferPoolIdle());
+
+    setBufferPoolLimit(2048);
+    check(bufferPoolIdle() == 2048, "trimmed to the new limit", 2048, bufferPoolIdle());
+    size_t capacity;
+    void *kept = takeBuffer(1024, &capacity);
+    void *keptToo = takeBuffer(1024, &capacity);
+    check((kept == a || kept == b) && (keptToo == a || keptToo == b) && bufferPoolIdle() == 0,
+          "largest class trimmed first", 2048, bufferPoolIdle());
+    giveBuffer(kept, capacity);
+    giveBuffer(keptToo, capacity);
+
+    setBufferPoolLimit(1000);
+    check(bufferPoolIdle() == 0, "trimmed below a single buffer", 1000, bufferPoolIdle());
+    setBufferPoolLimit(BUFPOOL_DEFAULT_LIMIT);
+}
+
+int main(void) {
+    testClasses();
+    testReuse();
+    testLimit();
+    printf(failures == 0 ? "ok   bufpool\n" : "FAIL bufpool\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "otp_cipher.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CIPHER_X86 1
+#endif
+
+// Scalar reference: the original per-character loops, with validation folded in
+
+static int validateScalar(const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if ((text[i] < 'A' || text[i] > 'Z') && text[i] != ' ') {
+            return -1; // Invalid character detected
+        }
+    }
+    return 0;
+}
+
+static int encryptScalar(const char *plaintext, const char *key, char *ciphertext, size_t len) {
+    if (validateScalar(plaintext, len) < 0) return CIPHER_BAD_TEXT;
+    if (validateScalar(key, len) < 0) return CIPHER_BAD_KEY;
+    for (size_t i = 0; i < len; i++) {
+        int plainVal = (plaintext[i] == ' ') ? 26 : plaintext[i] - 'A'; // Convert char to 0-26
+        int keyVal = (key[i] == ' ') ? 26 : key[i] - 'A'; // Convert char to 0-26
+        int cipherVal = (plainVal + keyVal) % 27; // Encrypt using modular addition
+        ciphertext[i] = (cipherVal == 26) ? ' ' : 'A' + cipherVal; // Convert back to char
+    }
+    return CIPHER_OK;
+}
+
+static int decryptScalar(const char *ciphertext, const char *key, char *plaintext, size_t len) {
+    if (validateScalar(ciphertext, len) < 0) return CIPHER_BAD_TEXT;
+    if (validateScalar(key, len) < 0) return CIPHER_BAD_KEY;
+    for (size_t i = 0; i < len; i++) {
+        int cipherVal = (ciphertext[i] == ' ') ? 26 : ciphertext[i] - 'A'; // Map space to 26, A-Z to 0-25
+        int keyVal = (key[i] == ' ') ? 26 : key[i] - 'A'; // Map key space similarly
+        int plainVal = (cipherVal - keyVal + 27) % 27; // Perform decryption with wrap-around
+        plaintext[i] = (plainVal == 26) ? ' ' : 'A' + plainVal; // Map back to char
+    }
+    return CIPHER_OK;
+}
+
+// Binary mode: any byte is valid and both directions are the same XOR, a word at a time
+
+static int xorScalar(const char *text, const char *key, char *out, size_t len) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t t, k;
+        memcpy(&t, text + i, sizeof(t)); // Compiles to unaligned loads
+        memcpy(&k, key + i, sizeof(k));
+        t ^= k;
+        memcpy(out + i, &t, sizeof(t));
+    }
+    for (; i < len; i++) {
+        out[i] = text[i] ^ key[i];
+    }
+    return CIPHER_OK;
+}
+
+#ifdef CIPHER_X86
+
+/*
+ * Vector kernels. Per byte lane:
+ *   v = c - 'A'            valid letters land on 0..25 (unsigned)
+ *   v = 26 where c == ' '
+ *   bad |= lanes that were neither
+ * Values are combined with one add/sub and a single conditional +-27, then
+ * mapped back with v + 'A', patching lane value 26 to ' '.
+ */
+
+// SSE2: 16 symbols per step
+
+static inline __m128i mapSse2(__m128i c, __m128i *bad) {
+    __m128i isSpace = _mm_cmpeq_epi8(c, _mm_set1_epi8(' '));
+    __m128i v = _mm_sub_epi8(c, _mm_set1_epi8('A'));
+    __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(25)), v);
+    *bad = _mm_or_si128(*bad, _mm_andnot_si128(_mm_or_si128(isLetter, isSpace), _mm_set1_epi8(-1)));
+    return _mm_or_si128(_mm_andnot_si128(isSpace, v), _mm_and_si128(isSpace, _mm_set1_epi8(26)));
+}
+
+static inline __m128i unmapSse2(__m128i v) {
+    __m128i isSpace = _mm_cmpeq_epi8(v, _mm_set1_epi8(26));
+    __m128i letters = _mm_add_epi8(v, _mm_set1_epi8('A'));
+    return _mm_or_si128(_mm_andnot_si128(isSpace, letters), _mm_and_si128(isSpace, _mm_set1_epi8(' ')));
+}
+
+static int validateSse2(const char *text, size_t len) {
+    __m128i bad = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        mapSse2(_mm_loadu_si128((const __m128i *)(text + i)), &bad);
+    }
+    if (_mm_movemask_epi8(bad) != 0) return -1;
+    return validateScalar(text + i, len - i);
+}
+
+static int combineSse2(const char *text, const char *key, char *out, size_t len, int decrypt) {
+    __m128i badText = _mm_setzero_si128(), badKey = _mm_setzero_si128();
+    __m128i mod = _mm_set1_epi8(27);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i t = mapSse2(_mm_loadu_si128((const __m128i *)(text + i)), &badText);
+        __m128i k = mapSse2(_mm_loadu_si128((const __m128i *)(key + i)), &badKey);
+        __m128i v;
+        if (decrypt) {
+            v = _mm_sub_epi8(t, k); // -26..26
+            v = _mm_add_epi8(v, _mm_and_si128(_mm_cmpgt_epi8(_mm_setzero_si128(), v), mod));
+        } else {
+            v = _mm_add_epi8(t, k); // 0..52
+            v = _mm_sub_epi8(v, _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(26)), mod));
+        }
+        _mm_storeu_si128((__m128i *)(out + i), unmapSse2(v));
+    }
+    if (_mm_movemask_epi8(badText) != 0) return CIPHER_BAD_TEXT;
+    if (_mm_movemask_epi8(badKey) != 0) {
+        // The text tail may still hold a bad character, and text errors take precedence
+        return validateScalar(text + i, len - i) < 0 ? CIPHER_BAD_TEXT : CIPHER_BAD_KEY;
+    }
+    return decrypt ? decryptScalar(text + i, key + i, out + i, len - i)
+                   : encryptScalar(text + i, key + i, out + i, len - i);
+}
+
+static int xorSse2(const char *text, const char *key, char *out, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i t = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i k = _mm_loadu_si128((const __m128i *)(key + i));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(t, k));
+    }
+    return xorScalar(text + i, key + i, out + i, len - i);
+}
+
+static int encryptSse2(const char *plaintext, const char *key, char *ciphertext, size_t len) {
+    return combineSse2(plaintext, key, ciphertext, len, 0);
+}
+
+static int decryptSse2(const char *ciphertext, const char *key, char *plaintext, size_t len) {
+    return combineSse2(ciphertext, key, plaintext, len, 1);
+}
+
+// AVX2: 32 symbols per step, compiled for AVX2 only in these functions
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i mapAvx2(__m256i c, __m256i *bad) {
+    __m256i isSpace = _mm256_cmpeq_epi8(c, _mm256_set1_epi8(' '));
+    __m256i v = _mm256_sub_epi8(c, _mm256_set1_epi8('A'));
+    __m256i isLetter = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(25)), v);
+    *bad = _mm256_or_si256(*bad, _mm256_andnot_si256(_mm256_or_si256(isLetter, isSpace), _mm256_set1_epi8(-1)));
+    return _mm256_blendv_epi8(v, _mm256_set1_epi8(26), isSpace);
+}
+
+static inline AVX2 __m256i unmapAvx2(__m256i v) {
+    __m256i isSpace = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(26));
+    return _mm256_blendv_epi8(_mm256_add_epi8(v, _mm256_set1_epi8('A')), _mm256_set1_epi8(' '), isSpace);
+}
+
+static AVX2 int validateAvx2(const char *text, size_t len) {
+    __m256i bad = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        mapAvx2(_mm256_loadu_si256((const __m256i *)(text + i)), &bad);
+    }
+    if (!_mm256_testz_si256(bad, bad)) return -1;
+    return validateSse2(text + i, len - i);
+}
+
+static AVX2 int combineAvx2(const char *text, const char *key, char *out, size_t len, int decrypt) {
+    __m256i badText = _mm256_setzero_si256(), badKey = _mm256_setzero_si256();
+    __m256i mod = _mm256_set1_epi8(27);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i t = mapAvx2(_mm256_loadu_si256((const __m256i *)(text + i)), &badText);
+        __m256i k = mapAvx2(_mm256_loadu_si256((const __m256i *)(key + i)), &badKey);
+        __m256i v;
+        if (decrypt) {
+            v = _mm256_sub_epi8(t, k);
+            v = _mm256_add_epi8(v, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_setzero_si256(), v), mod));
+        } else {
+            v = _mm256_add_epi8(t, k);
+            v = _mm256_sub_epi8(v, _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(26)), mod));
+        }
+        _mm256_storeu_si256((__m256i *)(out + i), unmapAvx2(v));
+    }
+    if (!_mm256_testz_si256(badText, badText)) return CIPHER_BAD_TEXT;
+    if (!_mm256_testz_si256(badKey, badKey)) {
+        return validateSse2(text + i, len - i) < 0 ? CIPHER_BAD_TEXT : CIPHER_BAD_KEY;
+    }
+    return combineSse2(text + i, key + i, out + i, len - i, decrypt);
+}
+
+// Four vectors per step keep both load ports busy at memory bandwidth
+static AVX2 int xorAvx2(const char *text, const char *key, char *out, size_t len) {
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {
+        for (size_t j = i; j < i + 128; j += 32) {
+            __m256i t = _mm256_loadu_si256((const __m256i *)(text + j));
+            __m256i k = _mm256_loadu_si256((const __m256i *)(key + j));
+            _mm256_storeu_si256((__m256i *)(out + j), _mm256_xor_si256(t, k));
+        }
+    }
+    return xorSse2(text + i, key + i, out + i, len - i);
+}
+
+static AVX2 int encryptAvx2(const char *plaintext, const char *key, char *ciphertext, size_t len) {
+    return combineAvx2(plaintext, key, ciphertext, len, 0);
+}
+
+static AVX2 int decryptAvx2(const char *ciphertext, const char *key, char *plaintext, size_t len) {
+    return combineAvx2(ciphertext, key, plaintext, len, 1);
+}
+
+#endif // CIPHER_X86
+
+static const struct cipherKernels kernels[] = {
+#ifdef CIPHER_X86
+    { "avx2", encryptAvx2, decryptAvx2, validateAvx2, xorAvx2 },
+    { "sse2", encryptSse2, decryptSse2, validateSse2, xorSse2 },
+#endif
+    { "scalar", encryptScalar, decryptScalar, validateScalar, xorScalar }
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+static int cpuSupports(const struct cipherKernels *candidate) {
+#ifdef CIPHER_X86
+    __builtin_cpu_init();
+    if (strcmp(candidate->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(candidate->name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+    return strcmp(candidate->name, "scalar") == 0;
+}
+
+const struct cipherKernels *cipherKernelsByName(const char *name) {
+    for (size_t i = 0; i < KERNEL_COUNT; i++) {
+        if (strcmp(kernels[i].name, name) == 0) {
+            return cpuSupports(&kernels[i]) ? &kernels[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+static const struct cipherKernels *active = &kernels[KERNEL_COUNT - 1];
+
+// Pick the widest supported kernel before main() runs, so callers never race on it
+__attribute__((constructor)) static void selectKernels(void) {
+    const char *forced = getenv("OTP_CIPHER");
+    if (forced != NULL && cipherKernelsByName(forced) != NULL) {
+        active = cipherKernelsByName(forced);
+        return;
+    }
+    for (size_t i = 0; i < KERNEL_COUNT; i++) {
+        if (cpuSupports(&kernels[i])) {
+            active = &kernels[i];
+            return;
+        }
+    }
+}
+
+int encryptSymbols(const char *plaintext, const char *key, char *ciphertext, size_t len) {
+    return active->encrypt(plaintext, key, ciphertext, len);
+}
+
+int decryptSymbols(const char *ciphertext, const char *key, char *plaintext, size_t len) {
+    return active->decrypt(ciphertext, key, plaintext, len);
+}
+
+int validateSymbols(const char *text, size_t len) {
+    return active->validate(text, len);
+}
+
+int xorBytes(const char *text, const char *key, char *out, size_t len) {
+    return active->xorBytes(text, key, out, len);
+}
+
+const char *cipherImplementation(void) {
+    return active->name;
+}
+
+// Packed form. Division by the constant 27 compiles to a multiply and shift,
+// so a whole group is unpacked, combined and repacked in registers
+
+#define PACKED_GROUP_LIMIT 14348907u // 27^5
+
+size_t packedSize(size_t len) {
+    return (len + PACKED_GROUP_SYMBOLS - 1) / PACKED_GROUP_SYMBOLS * PACKED_GROUP_BYTES;
+}
+
+static inline uint32_t getGroup(const unsigned char *in) {
+    return ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8) | (uint32_t)in[2];
+}
+
+static inline void putGroup(unsigned char *out, uint32_t group) {
+    out[0] = (unsigned char)(group >> 16);
+    out[1] = (unsigned char)(group >> 8);
+    out[2] = (unsigned char)group;
+}
+
+// Symbol value 0-26, or -1 outside the alphabet
+static inline int symbolValue(char c) {
+    if (c == ' ') return 26;
+    return (unsigned char)(c - 'A') < 26 ? c - 'A' : -1;
+}
+
+// Pack n <= 5 plain symbols; PACKED_INVALID_GROUP if any is outside the alphabet
+static inline uint32_t packGroup(const char *text, size_t n) {
+    uint32_t group = 0;
+    int bad = 0;
+    for (size_t j = n; j-- > 0;) {
+        int v = symbolValue(text[j]);
+        bad |= v < 0;
+        group = group * 27 + (uint32_t)v;
+    }
+    return bad ? PACKED_INVALID_GROUP : group;
+}
+
+void packSymbols(const char *text, unsigned char *out, size_t len) {
+    for (size_t i = 0; i < len; i += PACKED_GROUP_SYMBOLS, out += PACKED_GROUP_BYTES) {
+        size_t n = len - i < PACKED_GROUP_SYMBOLS ? len - i : PACKED_GROUP_SYMBOLS;
+        putGroup(out, packGroup(text + i, n));
+    }
+}
+
+int unpackSymbols(const unsigned char *in, char *text, size_t len) {
+    for (size_t i = 0; i < len; i += PACKED_GROUP_SYMBOLS, in += PACKED_GROUP_BYTES) {
+        size_t n = len - i < PACKED_GROUP_SYMBOLS ? len - i : PACKED_GROUP_SYMBOLS;
+        uint32_t group = getGroup(in);
+        if (group >= PACKED_GROUP_LIMIT) return -1;
+        for (size_t j = 0; j < n; j++) {
+            uint32_t v = group % 27;
+            group /= 27;
+            text[i + j] = (v == 26) ? ' ' : (char)('A' + v);
+        }
+    }
+    return 0;
+}
+
+// Digit-wise (t +- k) mod 27 of two groups. Digits past n come out as zero
+static inline uint32_t combineGroups(uint32_t t, uint32_t k, size_t n, int decrypt) {
+    uint32_t digits[PACKED_GROUP_SYMBOLS] = { 0 };
+    for (size_t j = 0; j < n; j++) {
+        uint32_t v = decrypt ? t % 27 + 27 - k % 27 : t % 27 + k % 27; // 0..53
+        digits[j] = v >= 27 ? v - 27 : v;
+        t /= 27;
+        k /= 27;
+    }
+    uint32_t group = 0;
+    for (size_t j = PACKED_GROUP_SYMBOLS; j-- > 0;) {
+        group = group * 27 + digits[j];
+    }
+    return group;
+}
+
+static int combinePacked(const unsigned char *text, const char *key, int keyPacked, unsigned char *out,
+                         size_t len, int decrypt) {
+    int badText = 0, badKey = 0;
+    for (size_t i = 0; i < len; i += PACKED_GROUP_SYMBOLS) {
+        size_t n = len - i < PACKED_GROUP_SYMBOLS ? len - i : PACKED_GROUP_SYMBOLS;
+        size_t at = i / PACKED_GROUP_SYMBOLS * PACKED_GROUP_BYTES;
+        uint32_t t = getGroup(text + at);
+        uint32_t k = keyPacked ? getGroup((const unsigned char *)key + at) : packGroup(key + i, n);
+        badText |= t >= PACKED_GROUP_LIMIT;
+        badKey |= k >= PACKED_GROUP_LIMIT;
+        putGroup(out + at, combineGroups(t, k, n, decrypt));
+    }
+    if (badText) return CIPHER_BAD_TEXT; // Text errors take precedence, as in the kernels above
+    return badKey ? CIPHER_BAD_KEY : CIPHER_OK;
+}
+
+int encryptPacked(const unsigned char *plaintext, const char *key, int keyPacked, unsigned char *ciphertext, size_t len) {
+    return combinePacked(plaintext, key, keyPacked, ciphertext, len, 0);
+}
+
+int decryptPacked(const unsigned char *ciphertext, const char *key, int keyPacked, unsigned char *plaintext, size_t len) {
+    return combinePacked(ciphertext, key, keyPacked, plaintext, len, 1);
+}
@@ -0,0 +1,68 @@
+#ifndef OTP_CIPHER_H
+#define OTP_CIPHER_H
+
+#include <stddef.h>
+
+/*
+ * Mod-27 one-time-pad kernels over the alphabet A-Z plus space (space = 26).
+ *
+ * Each kernel validates, maps and combines text and key in a single pass and
+ * reports which input (if any) contained a character outside the alphabet.
+ * On failure the contents of `out` are unspecified.
+ *
+ * Binary mode (xorBytes) works on arbitrary bytes instead: out = text ^ key,
+ * which both encrypts and decrypts and never fails.
+ */
+
+#define CIPHER_OK 0
+#define CIPHER_BAD_TEXT -1
+#define CIPHER_BAD_KEY -2
+
+typedef int (*cipherKernel)(const char *text, const char *key, char *out, size_t len);
+
+struct cipherKernels {
+    const char *name;
+    cipherKernel encrypt;
+    cipherKernel decrypt;
+    int (*validate)(const char *text, size_t len); // 0 if valid, -1 otherwise
+    cipherKernel xorBytes; // Binary mode, always CIPHER_OK
+};
+
+// Best implementation for this CPU, chosen once at startup.
+// Set OTP_CIPHER=scalar|sse2|avx2 in the environment to force one
+int encryptSymbols(const char *plaintext, const char *key, char *ciphertext, size_t len);
+int decryptSymbols(const char *ciphertext, const char *key, char *plaintext, size_t len);
+int validateSymbols(const char *text, size_t len);
+int xorBytes(const char *text, const char *key, char *out, size_t len);
+const char *cipherImplementation(void);
+
+// A specific implementation, or NULL if this CPU cannot run it
+const struct cipherKernels *cipherKernelsByName(const char *name);
+
+/*
+ * Packed form: every group of 5 symbols is one base-27 number (first symbol
+ * least significant, space = 26) in 3 big-endian bytes, since 27^5 < 2^24.
+ * A short final group is padded with zero digits. Groups of 27^5 and above
+ * are invalid; packSymbols writes PACKED_INVALID_GROUP for any group holding
+ * a character outside the alphabet, so the server reports it as usual.
+ */
+
+#define PACKED_GROUP_SYMBOLS 5
+#define PACKED_GROUP_BYTES 3
+#define PACKED_INVALID_GROUP 0xFFFFFFu
+
+// Bytes that len symbols take in packed form
+size_t packedSize(size_t len);
+
+void packSymbols(const char *text, unsigned char *out, size_t len);
+
+// Returns 0, or -1 (out unspecified) if any group is out of range
+int unpackSymbols(const unsigned char *in, char *text, size_t len);
+
+// Combine len packed symbols of text with the key straight into packed output,
+// never going through ASCII. The key is packed too unless keyPacked is 0, in
+// which case it is len plain symbols (a server-side pad). Same status codes as above
+int encryptPacked(const unsigned char *plaintext, const char *key, int keyPacked, unsigned char *ciphertext, size_t len);
+int decryptPacked(const unsigned char *ciphertext, const char *key, int keyPacked, unsigned char *plaintext, size_t len);
+
+#endif
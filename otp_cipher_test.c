@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "otp_cipher.h"
+#include "otp_core.h"
+#include "otp_protocol.h"
+
+// The original enc_server/dec_server loops, kept verbatim as the reference
+static void referenceEncrypt(const char *plaintext, const char *key, char *ciphertext, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        int plainVal = (plaintext[i] == ' ') ? 26 : plaintext[i] - 'A';
+        int keyVal = (key[i] == ' ') ? 26 : key[i] - 'A';
+        int cipherVal = (plainVal + keyVal) % 27;
+        ciphertext[i] = (cipherVal == 26) ? ' ' : 'A' + cipherVal;
+    }
+}
+
+static void referenceDecrypt(const char *ciphertext, const char *key, char *plaintext, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        int cipherVal = (ciphertext[i] == ' ') ? 26 : ciphertext[i] - 'A';
+        int keyVal = (key[i] == ' ') ? 26 : key[i] - 'A';
+        int plainVal = (cipherVal - keyVal + 27) % 27;
+        plaintext[i] = (plainVal == 26) ? ' ' : 'A' + plainVal;
+    }
+}
+
+static int failures = 0;
+
+static void check(int condition, const char *kernel, const char *what, size_t len) {
+    if (!condition) {
+        fprintf(stderr, "FAIL [%s] %s (len %zu)\n", kernel, what, len);
+        failures++;
+    }
+}
+
+static void randomSymbols(char *buffer, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        int v = rand() % 27;
+        buffer[i] = (v == 26) ? ' ' : 'A' + v;
+    }
+}
+
+// Every kernel must match the reference byte for byte, including vector tails
+static void testMatchesReference(const struct cipherKernels *k, char *text, char *key, char *expected, char *actual) {
+    static const size_t lengths[] = { 0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 1000, 4097, 65536 };
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t len = lengths[l];
+        randomSymbols(text, len);
+        randomSymbols(key, len);
+
+        referenceEncrypt(text, key, expected, len);
+        check(k->encrypt(text, key, actual, len) == CIPHER_OK, k->name, "encrypt status", len);
+        check(memcmp(expected, actual, len) == 0, k->name, "encrypt output", len);
+
+        referenceDecrypt(text, key, expected, len);
+        check(k->decrypt(text, key, actual, len) == CIPHER_OK, k->name, "decrypt status", len);
+        check(memcmp(expected, actual, len) == 0, k->name, "decrypt output", len);
+
+        check(k->validate(text, len) == 0, k->name, "validate accepts alphabet", len);
+    }
+}
+
+// Binary mode: XOR of arbitrary bytes, in place too, at every vector tail length
+static void testXor(const struct cipherKernels *k, char *text, char *key, char *expected, char *actual) {
+    for (size_t len = 0; len <= 300; len++) {
+        for (size_t i = 0; i < len; i++) {
+            text[i] = (char)rand();
+            key[i] = (char)rand();
+            expected[i] = text[i] ^ key[i];
+        }
+        check(k->xorBytes(text, key, actual, len) == CIPHER_OK, k->name, "xor status", len);
+        check(memcmp(expected, actual, len) == 0, k->name, "xor output", len);
+        k->xorBytes(actual, key, actual, len);
+        check(memcmp(text, actual, len) == 0, k->name, "xor round trip in place", len);
+    }
+}
+
+// Every byte value outside the alphabet is caught in every lane position
+static void testRejectsInvalid(const struct cipherKernels *k, char *text, char *key, char *out) {
+    const size_t len = 67; // Two AVX2 blocks plus a scalar tail
+    for (int c = 0; c < 256; c++) {
+        if ((c >= 'A' && c <= 'Z') || c == ' ') continue;
+        for (size_t pos = 0; pos < len; pos++) {
+            randomSymbols(text, len);
+            randomSymbols(key, len);
+            text[pos] = (char)c;
+            check(k->validate(text, len) == -1, k->name, "validate rejects", pos);
+            check(k->encrypt(text, key, out, len) == CIPHER_BAD_TEXT, k->name, "encrypt bad text", pos);
+            check(k->decrypt(text, key, out, len) == CIPHER_BAD_TEXT, k->name, "decrypt bad text", pos);
+
+            text[pos] = 'Q';
+            key[pos] = (char)c;
+            check(k->encrypt(text, key, out, len) == CIPHER_BAD_KEY, k->name, "encrypt bad key", pos);
+            check(k->decrypt(text, key, out, len) == CIPHER_BAD_KEY, k->name, "decrypt bad key", pos);
+
+            text[len - 1 - pos] = '@'; // A bad text character anywhere wins over a bad key
+            check(k->encrypt(text, key, out, len) == CIPHER_BAD_TEXT, k->name, "text error precedence", pos);
+        }
+    }
+}
+
+// The packed kernels must agree with the reference through pack/unpack, with
+// the key packed or plain, and pad short final groups with zero digits
+static void testPacked(char *text, char *key, char *expected, char *actual) {
+    static const size_t lengths[] = { 0, 1, 4, 5, 6, 9, 10, 11, 99, 100, 4097, 65535 };
+    unsigned char *packedText = malloc(packedSize(65535)), *packedKey = malloc(packedSize(65535));
+    unsigned char *packedExpected = malloc(packedSize(65535)), *packedOut = malloc(packedSize(65535));
+
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t len = lengths[l], bytes = packedSize(len);
+        randomSymbols(text, len);
+        randomSymbols(key, len);
+        packSymbols(text, packedText, len);
+        packSymbols(key, packedKey, len);
+        check(bytes == (len + 4) / 5 * 3, "packed", "size", len);
+        check(unpackSymbols(packedText, actual, len) == 0 && memcmp(text, actual, len) == 0, "packed", "round trip", len);
+
+        for (int keyPacked = 0; keyPacked <= 1; keyPacked++) {
+            const char *k = keyPacked ? (const char *)packedKey : key;
+            referenceEncrypt(text, key, expected, len);
+            packSymbols(expected, packedExpected, len);
+            check(encryptPacked(packedText, k, keyPacked, packedOut, len) == CIPHER_OK, "packed", "encrypt status", len);
+            check(memcmp(packedExpected, packedOut, bytes) == 0, "packed", "encrypt output", len);
+
+            referenceDecrypt(text, key, expected, len);
+            packSymbols(expected, packedExpected, len);
+            check(decryptPacked(packedText, k, keyPacked, packedOut, len) == CIPHER_OK, "packed", "decrypt status", len);
+            check(memcmp(packedExpected, packedOut, bytes) == 0, "packed", "decrypt output", len);
+        }
+    }
+
+    // Bad characters pack to groups every kernel rejects, text errors first
+    const size_t len = 23;
+    for (size_t pos = 0; pos < len; pos++) {
+        randomSymbols(text, len);
+        randomSymbols(key, len);
+        text[pos] = 'a';
+        packSymbols(text, packedText, len);
+        packSymbols(key, packedKey, len);
+        check(unpackSymbols(packedText, actual, len) == -1, "packed", "unpack rejects", pos);
+        check(encryptPacked(packedText, (const char *)packedKey, 1, packedOut, len) == CIPHER_BAD_TEXT, "packed",
+              "encrypt bad text", pos);
+
+        text[pos] = 'Q';
+        key[pos] = '\n';
+        packSymbols(text, packedText, len);
+        packSymbols(key, packedKey, len);
+        check(decryptPacked(packedText, (const char *)packedKey, 1, packedOut, len) == CIPHER_BAD_KEY, "packed",
+              "decrypt bad key", pos);
+        check(encryptPacked(packedText, key, 0, packedOut, len) == CIPHER_BAD_KEY, "packed", "plain bad key", pos);
+
+        packedText[(len - 1 - pos) / 5 * 3] = 0xFF; // Out of range group
+        check(encryptPacked(packedText, key, 0, packedOut, len) == CIPHER_BAD_TEXT, "packed", "text error precedence", pos);
+    }
+
+    free(packedText);
+    free(packedKey);
+    free(packedExpected);
+    free(packedOut);
+}
+
+// libotp batches: each job gets its own status, failures are counted and never
+// stop the jobs after them, and a round trip gives the text back
+static void testBatch(char *text, char *key, char *expected, char *actual) {
+    enum { JOBS = 8, LEN = 1000 };
+    struct otpJob jobs[JOBS];
+    randomSymbols(text, JOBS * LEN);
+    randomSymbols(key, JOBS * LEN);
+    for (size_t j = 0; j < JOBS; j++) {
+        struct otpJob job = { text + j * LEN, key + j * LEN, actual + j * LEN, LEN - j, 0, -99 };
+        jobs[j] = job;
+    }
+    text[2 * LEN + 7] = 'a';
+    key[5 * LEN] = '.';
+
+    check(otpValidateBatch(jobs, JOBS) == 1, "batch", "validate count", 0);
+    check(jobs[2].status == CIPHER_BAD_TEXT && jobs[5].status == CIPHER_OK, "batch", "validate status", 0);
+    check(otpEncryptBatch(0, jobs, JOBS) == 2, "batch", "encrypt count", 0);
+    for (size_t j = 0; j < JOBS; j++) {
+        int want = j == 2 ? CIPHER_BAD_TEXT : j == 5 ? CIPHER_BAD_KEY : CIPHER_OK;
+        check(jobs[j].status == want, "batch", "encrypt status", j);
+        if (want != CIPHER_OK) continue;
+        referenceEncrypt(jobs[j].text, jobs[j].key, expected, jobs[j].len);
+        check(memcmp(expected, jobs[j].out, jobs[j].len) == 0, "batch", "encrypt output", j);
+    }
+
+    text[2 * LEN + 7] = 'A';
+    key[5 * LEN] = 'A';
+    check(otpEncryptBatch(0, jobs, JOBS) == 0, "batch", "encrypt clean", 0);
+    memcpy(expected, actual, JOBS * LEN); // Ciphertext becomes the decryption input
+    for (size_t j = 0; j < JOBS; j++) jobs[j].text = expected + j * LEN;
+    check(otpDecryptBatch(0, jobs, JOBS) == 0, "batch", "decrypt status", 0);
+    for (size_t j = 0; j < JOBS; j++) {
+        check(memcmp(text + j * LEN, actual + j * LEN, jobs[j].len) == 0, "batch", "round trip", j);
+    }
+
+    // Binary mode XORs whatever it is given
+    check(otpTransformBatch(OTP_OP_DECRYPT, OTP_FLAG_BINARY, jobs, JOBS) == 0, "batch", "binary status", 0);
+    check((char)(expected[0] ^ key[0]) == actual[0], "batch", "binary output", 0);
+}
+
+int main(void) {
+    static const char *names[] = { "scalar", "sse2", "avx2" };
+    char *text = malloc(65536), *key = malloc(65536), *expected = malloc(65536), *actual = malloc(65536);
+    srand(374);
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        const struct cipherKernels *k = cipherKernelsByName(names[i]);
+        if (k == NULL) {
+            printf("skip %s (not supported on this CPU)\n", names[i]);
+            continue;
+        }
+        testMatchesReference(k, text, key, expected, actual);
+        testRejectsInvalid(k, text, key, actual);
+        testXor(k, text, key, expected, actual);
+        printf("ok   %s\n", names[i]);
+    }
+    testPacked(text, key, expected, actual);
+    printf("ok   packed\n");
+    testBatch(text, key, expected, actual);
+    printf("ok   batch\n");
+    printf("dispatch selects %s\n", cipherImplementation());
+
+    free(text);
+    free(key);
+    free(expected);
+    free(actual);
+    return failures == 0 ? 0 : 1;
+}
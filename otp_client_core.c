@@ -0,0 +1,947 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "otp_cipher.h"
+#include "otp_client_core.h"
+#include "otp_core.h"
+#include "otp_keypool.h"
+#include "otp_protocol.h"
+
+static uint8_t encodingFlags; // OTP_FLAG_PACKED once usePackedEncoding has been called
+
+static uint8_t transportFlags; // OTP_FLAG_SHARED once useSharedMemory has been called
+
+void usePackedEncoding(void) {
+    encodingFlags |= OTP_FLAG_PACKED;
+}
+
+void useBinaryMode(void) {
+    encodingFlags |= OTP_FLAG_BINARY;
+}
+
+void useSharedMemory(void) {
+    transportFlags = OTP_FLAG_SHARED;
+}
+
+int isLocalAddress(const char *port) {
+    return strchr(port, '/') != NULL;
+}
+
+int connectLocalServer(const char *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "CLIENT: ERROR - socket path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, path);
+
+    int socketFD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socketFD < 0 || connect(socketFD, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "CLIENT: ERROR connecting to %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return socketFD;
+}
+
+// Returns nonzero for bytes stripped from the end of an input file. In binary
+// mode every byte is data
+static int isTrailing(char c, int trimSpaces) {
+    if (encodingFlags & OTP_FLAG_BINARY) return 0;
+    return c == '\n' || c == '\r' || (trimSpaces && c == ' ');
+}
+
+int parsePadReference(const char *spec, struct otpPadRef *ref) {
+    const char *colon = strrchr(spec, ':');
+    char *end;
+    if (spec[0] != '@' || colon == NULL || colon - spec - 1 < 1 || colon - spec - 1 >= OTP_PAD_ID_SIZE ||
+        colon[1] < '0' || colon[1] > '9') {
+        return -1;
+    }
+    errno = 0;
+    ref->offset = strtoull(colon + 1, &end, 10);
+    if (errno != 0 || *end != '\0') {
+        return -1;
+    }
+    memset(ref->id, 0, sizeof(ref->id));
+    memcpy(ref->id, spec + 1, (size_t)(colon - spec - 1));
+    return 0;
+}
+
+int takePoolKey(const char *spec, uint64_t length, struct inputFile *key) {
+    const char *colon = strchr(spec, ':');
+    if (spec[0] != '%' || colon == NULL || colon == spec + 1 || colon[1] == '\0') {
+        fprintf(stderr, "CLIENT: ERROR - bad pool key %s (expected %%pool_name:key_file)\n", spec);
+        return -1;
+    }
+    char name[256];
+    snprintf(name, sizeof(name), "%.*s", (int)(colon - spec - 1), spec + 1);
+    const char *keyFile = colon + 1;
+
+    struct keyPool *pool = openKeyPool(name);
+    if (pool == NULL) {
+        fprintf(stderr, "CLIENT: ERROR - no key pool %s (start keygen -P %s SIZE)\n", name, name);
+        return -1;
+    }
+    int binary = (encodingFlags & OTP_FLAG_BINARY) != 0;
+    if ((int)pool->binary != binary) {
+        fprintf(stderr, "CLIENT: ERROR - key pool %s holds %s keys\n", name, pool->binary ? "binary" : "text");
+        return -1;
+    }
+
+    // The key goes straight from the pool into the file the decrypting side will need,
+    // in keygen's format
+    size_t size = (size_t)length + !binary;
+    int fd = open(keyFile, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    char *data = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, (off_t)size) == 0) {
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "CLIENT: ERROR writing key file %s\n", keyFile);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    close(fd);
+    int status = takeKey(pool, data, (size_t)length);
+    if (status == 0 && !binary) data[length] = '\n';
+    munmap(data, size);
+    munmap(pool, sizeof(*pool) + pool->capacity);
+    if (status < 0) {
+        fprintf(stderr, "CLIENT: ERROR - key pool %s %s\n", name,
+                errno == EMSGSIZE ? "is smaller than the message" : "is not being refilled");
+        unlink(keyFile);
+        return -1;
+    }
+    // Trailing spaces are key symbols here
+    return openInputFile(keyFile, 0, key);
+}
+
+int openInputFile(const char *filename, int trimSpaces, struct inputFile *file) {
+    file->name = filename;
+    file->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (file->fd < 0) {
+        fprintf(stderr, "CLIENT: ERROR opening file %s\n", filename);
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(file->fd, &info) < 0 || info.st_size <= 0) {
+        fprintf(stderr, "CLIENT: ERROR reading file %s\n", filename);
+        close(file->fd);
+        return -1;
+    }
+
+    // Segments are sent straight out of the page cache, never copied into our own buffers
+    file->mapLength = (size_t)info.st_size;
+    void *data = mmap(NULL, file->mapLength, PROT_READ, MAP_SHARED, file->fd, 0);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "CLIENT: ERROR reading file %s\n", filename);
+        close(file->fd);
+        return -1;
+    }
+    madvise(data, file->mapLength, MADV_SEQUENTIAL);
+    file->data = data;
+
+    // Only the trailing newlines/spaces themselves are inspected
+    uint64_t length = (uint64_t)info.st_size;
+    while (length > 0 && isTrailing(file->data[length - 1], trimSpaces)) length--;
+    file->length = length;
+    return 0;
+}
+
+void closeInputFile(struct inputFile *file) {
+    munmap((void *)file->data, file->mapLength);
+    close(file->fd);
+}
+
+// Send len bytes of a file starting at offset without them passing through user space
+static int sendFileRange(int socketFD, struct inputFile *file, uint64_t offset, size_t len) {
+    off_t position = (off_t)offset;
+    while (len > 0) {
+        ssize_t n = sendfile(socketFD, file->fd, &position, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * Pipeline engine shared by single requests and keep-alive batches.
+ *
+ * The sender runs ahead of the reader by at most OTP_PIPELINE_WINDOW bytes of
+ * unanswered text, which the socket buffers can always absorb, so a blocking
+ * send never waits on a server that is itself blocked writing replies to us.
+ * A segment larger than the window goes out alone once everything before it
+ * has been answered. While every unanswered symbol belongs to the request
+ * being sent, the window widens to OTP_REQUEST_WINDOW: the server keeps
+ * reading that many segments of one request however far behind its replies
+ * are, and transforms them in parallel.
+ */
+
+struct pendingRequest {
+    uint8_t op;           // OTP_OP_ENCRYPT or OTP_OP_DECRYPT; a batch may mix them on one connection
+    int trimSpaces;       // Trailing spaces of its files are padding, not symbols (plaintext)
+    const char *textFile, *keyFile;
+    struct inputFile text, key;
+    const char *outFile;  // Reply goes here, opened when it starts arriving, or NULL for `out`
+    FILE *out;
+    int usesPad;          // Key comes from a server-side pad instead of `key`
+    struct otpPadRef pad;
+    int opened;           // Files are open (possibly by the caller)
+    int skipped;          // Failed locally, never sent
+    int failed;           // Server answered with an ERROR frame
+    uint64_t sent;        // Text symbols sent so far
+    uint64_t outstanding; // Symbols sent but not yet answered
+};
+
+struct pipeline {
+    int socketFD;
+    uint8_t flags;
+    segmentValidator validate;
+    struct pendingRequest *requests;
+    size_t count;
+    size_t sendIndex, readIndex;
+    size_t maxInFlight;   // Requests sent but not yet answered, 0 for no limit
+    int sendingBody;      // Header of requests[sendIndex] is out, body in progress
+    uint64_t inFlight;    // Sum of outstanding over all requests
+    size_t failures;
+    size_t overloaded;    // ... of which the server shed under load
+    char *textBuffer;     // Zeros standing in for the rest of a rejected request
+    char *response;
+    unsigned char *packedText, *packedKey; // The segment being sent, packed
+    char *unpacked;       // A packed reply segment, unpacked
+    int sharedFD;         // OTP_FLAG_SHARED: memfd for the server, or -1 before the first request
+    int sharedPassed;     // ... already handed over
+    char *shared;         // ... mapped, sharedSize bytes
+    size_t sharedSize;
+};
+
+static void closeInputs(struct pendingRequest *request) {
+    if (request->opened) {
+        closeInputFile(&request->text);
+        if (!request->usesPad) closeInputFile(&request->key);
+        request->opened = 0;
+    }
+}
+
+// Open and check a request's files; returns -1 (after printing why) if it cannot be sent
+static int prepareRequest(struct pendingRequest *request) {
+    if (!request->opened) {
+        int fromPool = request->keyFile[0] == '%';
+        if (request->keyFile[0] == '@') {
+            if (parsePadReference(request->keyFile, &request->pad) < 0) {
+                fprintf(stderr, "CLIENT: ERROR - bad pad reference %s (expected @pad_id:offset)\n", request->keyFile);
+                return -1;
+            }
+            request->usesPad = 1;
+        }
+        if (openInputFile(request->textFile, request->trimSpaces, &request->text) < 0) {
+            return -1;
+        }
+        if (!request->usesPad && (fromPool ? takePoolKey(request->keyFile, request->text.length, &request->key)
+                                           : openInputFile(request->keyFile, request->trimSpaces, &request->key)) < 0) {
+            closeInputFile(&request->text);
+            return -1;
+        }
+        request->opened = 1;
+    }
+    if (!request->usesPad && request->key.length < request->text.length) {
+        fprintf(stderr, "CLIENT: ERROR - Key %s too short to match %s\n", request->keyFile, request->textFile);
+        closeInputs(request);
+        return -1;
+    }
+    return 0;
+}
+
+// Symbols the next send step would add to the window
+static size_t nextSendSize(struct pipeline *p) {
+    struct pendingRequest *request = &p->requests[p->sendIndex];
+    if (!p->sendingBody) {
+        return 0; // A header costs nothing to the window
+    }
+    return segmentSymbols(request->text.length - request->sent, p->flags);
+}
+
+static void finishSending(struct pipeline *p) {
+    closeInputs(&p->requests[p->sendIndex]);
+    p->sendingBody = 0;
+    p->sendIndex++;
+}
+
+// Send the next header or segment. Returns -1 if the socket failed
+static int sendStep(struct pipeline *p) {
+    struct pendingRequest *request = &p->requests[p->sendIndex];
+
+    if (!p->sendingBody) {
+        if (prepareRequest(request) < 0) {
+            request->skipped = 1;
+            p->failures++;
+            p->sendIndex++;
+            return 0;
+        }
+        // The server learns the key length from the pad itself
+        unsigned char header[OTP_REQUEST_HEADER_SIZE + OTP_PAD_REF_SIZE];
+        struct otpRequestHeader frame = { request->op, p->flags, request->text.length, request->key.length };
+        size_t headerSize = OTP_REQUEST_HEADER_SIZE;
+        if (request->usesPad) {
+            frame.flags |= OTP_FLAG_PAD;
+            frame.keyLength = 0;
+            encodePadRef(&request->pad, header + OTP_REQUEST_HEADER_SIZE);
+            headerSize += OTP_PAD_REF_SIZE;
+        }
+        encodeRequestHeader(&frame, header);
+        if (sendAll(p->socketFD, header, headerSize) < 0) {
+            return -1;
+        }
+        p->sendingBody = 1;
+        if (request->text.length == 0) {
+            finishSending(p);
+        }
+        return 0;
+    }
+
+    size_t n = nextSendSize(p);
+    size_t bytes = (size_t)wireBytes(n, p->flags);
+    if (request->failed) {
+        // Already rejected: the server discards the rest, so leave the files untouched
+        memset(p->textBuffer, 0, bytes);
+        int status = request->usesPad ? sendAll(p->socketFD, p->textBuffer, bytes)
+                                      : sendSegment(p->socketFD, p->textBuffer, p->textBuffer, bytes);
+        if (status < 0) {
+            return -1;
+        }
+    } else {
+        const char *text = request->text.data + request->sent;
+        int status;
+        if (p->validate != NULL) {
+            p->validate(text, n);
+        }
+        if (p->flags & OTP_FLAG_PACKED) {
+            // Bad characters pack to invalid groups, which the server reports as usual
+            packSymbols(text, p->packedText, n);
+            if (request->usesPad) {
+                status = sendAll(p->socketFD, p->packedText, bytes);
+            } else {
+                packSymbols(request->key.data + request->sent, p->packedKey, n);
+                status = sendSegment(p->socketFD, (const char *)p->packedText, (const char *)p->packedKey, bytes);
+            }
+        } else if (!request->usesPad) {
+            status = sendSegment(p->socketFD, text, request->key.data + request->sent, n);
+        } else if (p->validate == NULL) {
+            status = sendFileRange(p->socketFD, &request->text, request->sent, n); // Nothing to look at
+        } else {
+            status = sendAll(p->socketFD, text, n);
+        }
+        if (status < 0) {
+            return -1;
+        }
+        request->outstanding += n;
+        p->inFlight += n;
+    }
+    request->sent += n;
+    if (request->sent == request->text.length) {
+        finishSending(p);
+    }
+    return 0;
+}
+
+// Where a request's reply goes, creating its output file on first use
+static FILE *replyOutput(struct pendingRequest *request) {
+    if (request->out == NULL) {
+        request->out = fopen(request->outFile, "w");
+        if (request->out == NULL) {
+            fprintf(stderr, "CLIENT: ERROR opening output file %s\n", request->outFile);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return request->out;
+}
+
+// Finish a request's reply: the newline that ends it, or for a failed request an
+// empty line on a shared stream (one line per request) and no file at all.
+// Binary replies are raw bytes and get no newline
+static void finishReply(struct pendingRequest *request, int failed) {
+    int newline = !(encodingFlags & OTP_FLAG_BINARY);
+    if (request->outFile == NULL) {
+        if (newline) fputc('\n', request->out);
+        fflush(request->out);
+        return;
+    }
+    if (!failed) {
+        FILE *out = replyOutput(request); // Creates even an empty reply's file
+        if (newline) fputc('\n', out);
+    }
+    if (request->out != NULL && fclose(request->out) != 0 && !failed) {
+        fprintf(stderr, "CLIENT: ERROR writing output file %s\n", request->outFile);
+        exit(EXIT_FAILURE);
+    }
+    request->out = NULL;
+    if (failed) {
+        unlink(request->outFile); // Never leave a partial reply behind
+    }
+}
+
+// Read one reply frame for requests[readIndex]. Returns -1 if the connection is gone
+static int readStep(struct pipeline *p) {
+    struct pendingRequest *request = &p->requests[p->readIndex];
+    unsigned char header[OTP_FRAME_HEADER_SIZE];
+    struct otpFrameHeader frame;
+
+    if (recvAll(p->socketFD, header, sizeof(header)) != sizeof(header)) {
+        return -1;
+    }
+    decodeFrameHeader(header, &frame);
+    if (frame.length > OTP_CHUNK_SIZE) {
+        fprintf(stderr, "CLIENT: ERROR - oversized response from server\n");
+        exit(EXIT_FAILURE);
+    }
+    if (frame.length > 0 && recvAll(p->socketFD, p->response, frame.length) != (ssize_t)frame.length) {
+        return -1;
+    }
+
+    switch (frame.type) {
+    case OTP_FRAME_DATA: {
+        const char *symbols = p->response;
+        uint64_t count = frame.length;
+        if (p->flags & OTP_FLAG_PACKED) {
+            // Only the last segment of a request may end in a partial group
+            count = (uint64_t)frame.length / PACKED_GROUP_BYTES * PACKED_GROUP_SYMBOLS;
+            if (count > request->outstanding) count = request->outstanding;
+            if (wireBytes(count, p->flags) != frame.length ||
+                unpackSymbols((const unsigned char *)p->response, p->unpacked, (size_t)count) < 0) {
+                fprintf(stderr, "CLIENT: ERROR - unexpected response from server\n");
+                exit(EXIT_FAILURE);
+            }
+            symbols = p->unpacked;
+        }
+        if (count > request->outstanding) {
+            fprintf(stderr, "CLIENT: ERROR - unexpected response from server\n");
+            exit(EXIT_FAILURE);
+        }
+        FILE *out = replyOutput(request);
+        fwrite(symbols, 1, count, out);
+        fflush(out); // Pass each chunk on as it arrives rather than when the reply ends
+        request->outstanding -= count;
+        p->inFlight -= count;
+        return 0;
+    }
+
+    case OTP_FRAME_END:
+        finishReply(request, 0);
+        p->readIndex++;
+        return 0;
+
+    case OTP_FRAME_ERROR:
+        fprintf(stderr, "%.*s\n", (int)frame.length, p->response);
+        if (frame.code == OTP_ERROR_OVERLOADED) p->overloaded++;
+        if (p->flags & OTP_FLAG_KEEPALIVE) {
+            finishReply(request, 1);
+        }
+        p->inFlight -= request->outstanding;
+        request->outstanding = 0;
+        request->failed = 1;
+        p->failures++;
+        p->readIndex++;
+        return 0;
+
+    default:
+        fprintf(stderr, "CLIENT: ERROR - unexpected response from server\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Make the shared memfd hold at least size bytes. It only ever grows, so the server
+// (which maps it afresh for every request) can rely on the seal against shrinking
+static void reserveShared(struct pipeline *p, size_t size) {
+    if (p->sharedFD < 0) {
+        p->sharedFD = memfd_create("otp", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (p->sharedFD < 0 || fcntl(p->sharedFD, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+            fprintf(stderr, "CLIENT: ERROR creating shared memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (size == 0) {
+        size = 1; // Empty requests still need something to map
+    }
+    if (size <= p->sharedSize && p->shared != NULL) {
+        return;
+    }
+    if (p->shared != NULL) {
+        munmap(p->shared, p->sharedSize);
+    }
+    void *map = ftruncate(p->sharedFD, (off_t)size) == 0
+                    ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, p->sharedFD, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "CLIENT: ERROR creating shared memory\n");
+        exit(EXIT_FAILURE);
+    }
+    p->shared = map;
+    p->sharedSize = size;
+}
+
+// Run one request through shared memory: copy text and key into the memfd, send
+// the header alone, and read the reply back from where the text was.
+// Returns -1 if the connection is gone
+static int sharedStep(struct pipeline *p) {
+    struct pendingRequest *request = &p->requests[p->sendIndex];
+    p->sendIndex++;
+    if (prepareRequest(request) < 0) {
+        request->skipped = 1;
+        p->failures++;
+        return 0;
+    }
+
+    uint64_t length = request->text.length;
+    size_t textBytes = (size_t)wireBytes(length, p->flags);
+    reserveShared(p, request->usesPad ? textBytes : 2 * textBytes);
+    if (p->validate != NULL) {
+        p->validate(request->text.data, length);
+    }
+    if (p->flags & OTP_FLAG_PACKED) {
+        packSymbols(request->text.data, (unsigned char *)p->shared, length);
+        if (!request->usesPad) packSymbols(request->key.data, (unsigned char *)p->shared + textBytes, length);
+    } else {
+        memcpy(p->shared, request->text.data, length);
+        if (!request->usesPad) memcpy(p->shared + textBytes, request->key.data, length);
+    }
+
+    unsigned char header[OTP_REQUEST_HEADER_SIZE + OTP_PAD_REF_SIZE];
+    struct otpRequestHeader frame = { request->op, p->flags, length, request->key.length };
+    size_t headerSize = OTP_REQUEST_HEADER_SIZE;
+    if (request->usesPad) {
+        frame.flags |= OTP_FLAG_PAD;
+        frame.keyLength = 0;
+        encodePadRef(&request->pad, header + OTP_REQUEST_HEADER_SIZE);
+        headerSize += OTP_PAD_REF_SIZE;
+    }
+    encodeRequestHeader(&frame, header);
+    closeInputs(request);
+    // The server keeps the memfd for the rest of the connection, so it goes along only once
+    int status = p->sharedPassed ? sendAll(p->socketFD, header, headerSize)
+                                 : sendWithDescriptor(p->socketFD, header, headerSize, p->sharedFD);
+    if (status < 0) {
+        return -1;
+    }
+    p->sharedPassed = 1;
+
+    // A lone END or ERROR frame; readStep handles the error
+    unsigned char reply[OTP_FRAME_HEADER_SIZE];
+    struct otpFrameHeader end;
+    if (recvAll(p->socketFD, reply, sizeof(reply)) != sizeof(reply)) {
+        return -1;
+    }
+    decodeFrameHeader(reply, &end);
+    if (end.type == OTP_FRAME_END && end.length == 0) {
+        FILE *out = replyOutput(request);
+        if (p->flags & OTP_FLAG_PACKED) {
+            // Unpacked a segment at a time through the reply buffer
+            for (uint64_t done = 0; done < length;) {
+                size_t n = segmentSymbols(length - done, p->flags);
+                if (unpackSymbols((unsigned char *)p->shared + wireBytes(done, p->flags), p->unpacked, n) < 0) {
+                    fprintf(stderr, "CLIENT: ERROR - unexpected response from server\n");
+                    exit(EXIT_FAILURE);
+                }
+                fwrite(p->unpacked, 1, n, out);
+                done += n;
+            }
+        } else {
+            fwrite(p->shared, 1, length, out);
+        }
+        finishReply(request, 0);
+        p->readIndex++;
+        return 0;
+    }
+    if (end.type != OTP_FRAME_ERROR || end.length > OTP_CHUNK_SIZE ||
+        recvAll(p->socketFD, p->response, end.length) != (ssize_t)end.length) {
+        fprintf(stderr, "CLIENT: ERROR - unexpected response from server\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "%.*s\n", (int)end.length, p->response);
+    if (end.code == OTP_ERROR_OVERLOADED) p->overloaded++;
+    if (p->flags & OTP_FLAG_KEEPALIVE) {
+        finishReply(request, 1);
+    }
+    request->failed = 1;
+    p->failures++;
+    p->readIndex++;
+    return 0;
+}
+
+// Wait until the socket can take more or has a reply for us. Returns 1 if a
+// reply is waiting: reading it first gets output going while the rest is sent,
+// and keeps the server from stalling on a full socket buffer
+static int replyWaiting(int socketFD) {
+    struct pollfd events = { socketFD, POLLIN | POLLOUT, 0 };
+    while (poll(&events, 1, -1) < 0) {
+        if (errno != EINTR) return 0; // Let the send report it
+    }
+    return (events.revents & POLLIN) != 0;
+}
+
+static size_t runEngine(struct pipeline *p) {
+    // Headers and segments are already coalesced; don't let Nagle hold them for an ACK
+    int on = 1;
+    setsockopt(p->socketFD, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    p->flags |= encodingFlags | transportFlags;
+    if (p->flags & OTP_FLAG_BINARY) {
+        p->validate = NULL; // Any byte is valid
+    }
+    p->sharedFD = -1;
+    int packed = (p->flags & OTP_FLAG_PACKED) != 0;
+    p->textBuffer = malloc(OTP_CHUNK_SIZE);
+    p->response = malloc(OTP_CHUNK_SIZE);
+    if (packed) {
+        p->packedText = malloc(packedSize(OTP_PACKED_CHUNK_SIZE));
+        p->packedKey = malloc(packedSize(OTP_PACKED_CHUNK_SIZE));
+        p->unpacked = malloc(OTP_PACKED_CHUNK_SIZE);
+    }
+    if (p->textBuffer == NULL || p->response == NULL ||
+        (packed && (p->packedText == NULL || p->packedKey == NULL || p->unpacked == NULL))) {
+        fprintf(stderr, "CLIENT: ERROR out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int single = !(p->flags & OTP_FLAG_KEEPALIVE);
+    while ((p->flags & OTP_FLAG_SHARED) && p->readIndex < p->count) {
+        // One request at a time: there is a single region to hand over
+        struct pendingRequest *next = &p->requests[p->readIndex];
+        if (sharedStep(p) < 0) {
+            fprintf(stderr, "CLIENT: ERROR talking to server\n");
+            exit(EXIT_FAILURE);
+        }
+        if (next->skipped) {
+            finishReply(next, 1);
+            p->readIndex++;
+        }
+        if (single && p->failures > 0) break;
+    }
+    while (p->readIndex < p->count) {
+        struct pendingRequest *next = &p->requests[p->readIndex];
+        if (next->skipped) {
+            finishReply(next, 1); // Only batches skip requests
+            p->readIndex++;
+            continue;
+        }
+        if (single && p->failures > 0) {
+            break; // The server has hung up on us
+        }
+
+        int mayStart = p->maxInFlight == 0 || p->sendIndex - p->readIndex < p->maxInFlight;
+        if (p->sendIndex < p->count && (p->sendingBody || mayStart)) {
+            size_t n = nextSendSize(p);
+            uint64_t window = p->sendIndex == p->readIndex ? OTP_REQUEST_WINDOW : OTP_PIPELINE_WINDOW;
+            int owed = p->inFlight > 0 || p->readIndex < p->sendIndex;
+            if ((p->inFlight == 0 || p->inFlight + n <= window) && !(owed && replyWaiting(p->socketFD))) {
+                if (sendStep(p) < 0) {
+                    // The server may have rejected us and hung up; report its reason if it sent one
+                    size_t before = p->failures;
+                    while (p->readIndex < p->count && p->failures == before && readStep(p) == 0);
+                    if (single && p->failures > before) break;
+                    fprintf(stderr, "CLIENT: ERROR writing to socket\n");
+                    exit(EXIT_FAILURE);
+                }
+                continue;
+            }
+        }
+
+        if (readStep(p) < 0) {
+            fprintf(stderr, "CLIENT: ERROR reading server response\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    free(p->textBuffer);
+    free(p->response);
+    free(p->packedText);
+    free(p->packedKey);
+    free(p->unpacked);
+    if (p->shared != NULL) munmap(p->shared, p->sharedSize);
+    if (p->sharedFD >= 0) close(p->sharedFD);
+    return p->failures;
+}
+
+// Run one already opened request without keep-alive, exiting if it fails
+static void runSingle(int socketFD, uint8_t op, struct pendingRequest *request, segmentValidator validate) {
+    struct pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.socketFD = socketFD;
+    p.validate = validate;
+    request->op = op;
+    p.requests = request;
+    p.count = 1;
+
+    if (runEngine(&p) > 0) {
+        exit(p.overloaded > 0 ? CLIENT_EXIT_BUSY : EXIT_FAILURE);
+    }
+}
+
+void streamRequest(int socketFD, uint8_t op, struct inputFile *text, struct inputFile *key,
+                   segmentValidator validate, FILE *out) {
+    struct pendingRequest request;
+    memset(&request, 0, sizeof(request));
+    request.textFile = text->name;
+    request.keyFile = key->name;
+    request.text = *text;
+    request.key = *key;
+    request.out = out;
+    request.opened = 1;
+    runSingle(socketFD, op, &request, validate);
+}
+
+void streamPadRequest(int socketFD, uint8_t op, struct inputFile *text, const struct otpPadRef *pad,
+                      segmentValidator validate, FILE *out) {
+    struct pendingRequest request;
+    memset(&request, 0, sizeof(request));
+    request.textFile = text->name;
+    request.keyFile = "@pad";
+    request.text = *text;
+    request.usesPad = 1;
+    request.pad = *pad;
+    request.out = out;
+    request.opened = 1;
+    runSingle(socketFD, op, &request, validate);
+}
+
+int isInProcess(const char *port) {
+    return strcmp(port, OTP_IN_PROCESS) == 0;
+}
+
+void runLocalRequest(uint8_t op, struct inputFile *text, struct inputFile *key, segmentValidator validate,
+                     FILE *out) {
+    uint8_t mode = encodingFlags & OTP_FLAG_BINARY; // Nothing goes over a wire, so nothing is packed
+    char *output = malloc((size_t)LOCAL_BATCH_JOBS * OTP_CHUNK_SIZE);
+    if (output == NULL) {
+        fprintf(stderr, "CLIENT: ERROR out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct otpJob jobs[LOCAL_BATCH_JOBS];
+    uint64_t offset = 0;
+    while (offset < text->length) {
+        size_t count = 0;
+        for (; count < LOCAL_BATCH_JOBS && offset < text->length; count++) {
+            size_t n = text->length - offset < OTP_CHUNK_SIZE ? (size_t)(text->length - offset) : OTP_CHUNK_SIZE;
+            struct otpJob job = { text->data + offset, key->data + offset, output + count * OTP_CHUNK_SIZE, n, 0, 0 };
+            if (validate != NULL && !mode) validate(job.text, n);
+            jobs[count] = job;
+            offset += n;
+        }
+
+        otpTransformBatch(op, mode, jobs, count);
+        for (size_t i = 0; i < count; i++) {
+            if (jobs[i].status != CIPHER_OK) {
+                fprintf(stderr, "CLIENT: ERROR - Invalid %s character\n",
+                        jobs[i].status == CIPHER_BAD_KEY ? "key" : op == OTP_OP_ENCRYPT ? "plaintext" : "ciphertext");
+                exit(EXIT_FAILURE);
+            }
+            fwrite(jobs[i].out, 1, jobs[i].len, out);
+        }
+    }
+    if (!mode) fputc('\n', out);
+    if (fflush(out) != 0) {
+        fprintf(stderr, "CLIENT: ERROR writing output\n");
+        exit(EXIT_FAILURE);
+    }
+    free(output);
+}
+
+void uploadPad(int socketFD, const char *padId, struct inputFile *pad) {
+    unsigned char header[OTP_REQUEST_HEADER_SIZE + OTP_PAD_REF_SIZE];
+    struct otpRequestHeader request = { OTP_OP_STORE_PAD, OTP_FLAG_PAD | encodingFlags, pad->length, 0 };
+    struct otpPadRef ref;
+    memset(&ref, 0, sizeof(ref));
+    strncpy(ref.id, padId, sizeof(ref.id) - 1);
+    encodeRequestHeader(&request, header);
+    encodePadRef(&ref, header + OTP_REQUEST_HEADER_SIZE);
+
+    char *buffer = malloc(OTP_CHUNK_SIZE);
+    if (buffer == NULL) {
+        fprintf(stderr, "CLIENT: ERROR out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The server stays silent until the whole pad is in, so stream it without reading.
+    // If it gives up early it says why before hanging up, so a failed send falls through to the reply
+    int sendFailed = sendAll(socketFD, header, sizeof(header)) < 0;
+    if (encodingFlags & OTP_FLAG_PACKED) {
+        // Packed in the buffer one segment at a time
+        for (uint64_t sent = 0; sent < pad->length && !sendFailed;) {
+            size_t n = segmentSymbols(pad->length - sent, encodingFlags);
+            packSymbols(pad->data + sent, (unsigned char *)buffer, n);
+            sendFailed = sendAll(socketFD, buffer, packedSize(n)) < 0;
+            sent += n;
+        }
+    } else if (!sendFailed) {
+        sendFailed = sendFileRange(socketFD, pad, 0, (size_t)pad->length) < 0;
+    }
+
+    unsigned char reply[OTP_FRAME_HEADER_SIZE];
+    struct otpFrameHeader frame;
+    if (recvAll(socketFD, reply, sizeof(reply)) != sizeof(reply)) {
+        fprintf(stderr, sendFailed ? "CLIENT: ERROR writing to socket\n" : "CLIENT: ERROR reading server response\n");
+        exit(EXIT_FAILURE);
+    }
+    decodeFrameHeader(reply, &frame);
+    if (frame.type == OTP_FRAME_END && frame.length == 0) {
+        free(buffer);
+        return;
+    }
+    if (frame.type == OTP_FRAME_ERROR && frame.length < OTP_CHUNK_SIZE &&
+        recvAll(socketFD, buffer, frame.length) == (ssize_t)frame.length) {
+        fprintf(stderr, "%.*s\n", (int)frame.length, buffer);
+        exit(frame.code == OTP_ERROR_OVERLOADED ? CLIENT_EXIT_BUSY : EXIT_FAILURE);
+    }
+    fprintf(stderr, "CLIENT: ERROR - unexpected response from server\n");
+    exit(EXIT_FAILURE);
+}
+
+// One connection's share of a batch
+struct batchShare {
+    pthread_t thread;
+    struct pipeline p;
+};
+
+static void *runShare(void *arg) {
+    struct batchShare *share = arg;
+    runEngine(&share->p);
+    return NULL;
+}
+
+size_t runBatch(const int *sockets, int connections, uint8_t op, int trimSpaces, size_t maxInFlight,
+                struct clientRequest *requests, size_t count) {
+    struct pendingRequest *pending = calloc(count > 0 ? count : 1, sizeof(*pending));
+    struct batchShare *shares = calloc((size_t)connections, sizeof(*shares));
+    if (pending == NULL || shares == NULL) {
+        fprintf(stderr, "CLIENT: ERROR out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < count; i++) {
+        // A request without an operation of its own gets the batch's
+        pending[i].op = requests[i].op != 0 ? requests[i].op : op;
+        pending[i].trimSpaces = requests[i].op != 0 ? requests[i].op == OTP_OP_ENCRYPT : trimSpaces;
+        pending[i].textFile = requests[i].textFile;
+        pending[i].keyFile = requests[i].keyFile;
+        pending[i].outFile = requests[i].outFile;
+        pending[i].out = requests[i].outFile != NULL ? NULL : requests[i].out;
+    }
+
+    // Each connection pipelines a contiguous run of the requests on its own thread
+    for (int c = 0; c < connections; c++) {
+        struct pipeline *p = &shares[c].p;
+        size_t first = count * (size_t)c / (size_t)connections;
+        size_t last = count * (size_t)(c + 1) / (size_t)connections;
+        p->socketFD = sockets[c];
+        p->flags = OTP_FLAG_KEEPALIVE;
+        p->maxInFlight = maxInFlight;
+        p->requests = pending + first;
+        p->count = last - first;
+        if (connections > 1 && pthread_create(&shares[c].thread, NULL, runShare, &shares[c]) != 0) {
+            fprintf(stderr, "CLIENT: ERROR starting connection thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    size_t failures = 0;
+    for (int c = 0; c < connections; c++) {
+        if (connections > 1) pthread_join(shares[c].thread, NULL);
+        else runEngine(&shares[c].p);
+        failures += shares[c].p.failures;
+    }
+    free(shares);
+    free(pending);
+    return failures;
+}
+
+int parseBatchOptions(int argc, char *argv[], struct batchOptions *options) {
+    int option;
+    memset(options, 0, sizeof(*options));
+    options->connections = 1;
+    options->maxInFlight = BATCH_IN_FLIGHT;
+    optind = 1; // argv[0] is the "-k" that selected batch mode
+    while ((option = getopt(argc, argv, "+j:n:o:d:K:")) != -1) {
+        switch (option) {
+        case 'j':
+            options->connections = atoi(optarg);
+            if (options->connections < 1) return -1;
+            break;
+        case 'n':
+            if (atoi(optarg) < 0) return -1;
+            options->maxInFlight = (size_t)atoi(optarg);
+            break;
+        case 'o': options->outDir = optarg; break;
+        case 'd': options->textDir = optarg; break;
+        case 'K': options->keyDir = optarg; break;
+        default: return -1;
+        }
+    }
+    // A directory batch needs a key directory and somewhere to put the results
+    if ((options->textDir != NULL) != (options->keyDir != NULL) ||
+        (options->textDir != NULL && options->outDir == NULL)) {
+        return -1;
+    }
+    return optind;
+}
+
+char *batchOutputPath(const char *outDir, const char *textFile) {
+    const char *name = strrchr(textFile, '/');
+    name = name != NULL ? name + 1 : textFile;
+    char *path;
+    if (asprintf(&path, "%s/%s", outDir, name) < 0) {
+        fprintf(stderr, "CLIENT: ERROR out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return path;
+}
+
+// Only regular files (or links to them) take part in a directory batch
+static int isBatchFile(const struct dirent *entry) {
+    return entry->d_name[0] != '.' && (entry->d_type == DT_REG || entry->d_type == DT_LNK ||
+                                       entry->d_type == DT_UNKNOWN);
+}
+
+struct clientRequest *listBatchDirectory(const struct batchOptions *options, size_t *count) {
+    struct dirent **entries;
+    int n = scandir(options->textDir, &entries, isBatchFile, alphasort);
+    if (n < 0) {
+        fprintf(stderr, "CLIENT: ERROR reading directory %s\n", options->textDir);
+        exit(EXIT_FAILURE);
+    }
+    struct clientRequest *requests = calloc(n > 0 ? (size_t)n : 1, sizeof(*requests));
+    if (requests == NULL) {
+        fprintf(stderr, "CLIENT: ERROR out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++) {
+        char *textFile, *keyFile;
+        if (asprintf(&textFile, "%s/%s", options->textDir, entries[i]->d_name) < 0 ||
+            asprintf(&keyFile, "%s/%s", options->keyDir, entries[i]->d_name) < 0) {
+            fprintf(stderr, "CLIENT: ERROR out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        requests[i].textFile = textFile;
+        requests[i].keyFile = keyFile; // The key for text_dir/NAME is key_dir/NAME
+        requests[i].outFile = batchOutputPath(options->outDir, entries[i]->d_name);
+        free(entries[i]);
+    }
+    free(entries);
+    *count = (size_t)n;
+    return requests;
+}
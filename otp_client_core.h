@@ -0,0 +1,127 @@
+#ifndef OTP_CLIENT_CORE_H
+#define OTP_CLIENT_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "otp_protocol.h"
+
+#define OTP_PIPELINE_WINDOW 65536 // Reply bytes a client lets the server owe it before it stops sending
+// ... while all of them belong to the request being sent, which the server reads ahead
+#define OTP_REQUEST_WINDOW ((uint64_t)OTP_PARALLEL_SEGMENTS * OTP_PACKED_CHUNK_SIZE)
+
+// An input file mapped for streaming. `length` excludes the trimmed trailing bytes
+struct inputFile {
+    const char *name;
+    int fd;
+    const char *data;  // Whole file, mapped read-only
+    size_t mapLength;
+    uint64_t length;
+};
+
+// One request of a pipelined batch, named by its files
+struct clientRequest {
+    uint8_t op;          // OTP_OP_ENCRYPT or OTP_OP_DECRYPT, or 0 for the batch's own (see runBatch)
+    const char *textFile;
+    const char *keyFile; // Or "@pad_id:offset" for a pad held by the server, or "%pool:key_file"
+    const char *outFile; // Receives the reply followed by a newline, or NULL to use `out`
+    FILE *out;           // Shared stream for the replies of requests without an outFile
+};
+
+// Exit status when the server shed the request under load (OTP_ERROR_OVERLOADED):
+// the same request may succeed if tried again later
+#define CLIENT_EXIT_BUSY 75
+
+// Requests a batch keeps sent but unanswered on each connection unless told otherwise
+#define BATCH_IN_FLIGHT 64
+
+// Batch mode: "-k [-j connections] [-n requests] [-o out_dir] [-d text_dir -K key_dir]"
+struct batchOptions {
+    int connections;    // Connections the requests are spread over
+    size_t maxInFlight; // Requests per connection sent but not yet answered, 0 for no limit
+    const char *outDir; // Write each reply to out_dir/NAME for text file NAME
+    const char *textDir, *keyDir; // Encrypt or decrypt every file in text_dir with the key of the same name
+};
+
+// Optional client-side check run on every text segment before it is sent
+typedef void (*segmentValidator)(const char *text, size_t len);
+
+// Send this and every later request with OTP_FLAG_PACKED: 5 symbols in 3 bytes
+// instead of one byte each, for text, key and replies alike
+void usePackedEncoding(void);
+
+// Treat text and key as raw bytes combined with XOR (OTP_FLAG_BINARY): input
+// files are not trimmed, nothing is validated and replies get no newline
+void useBinaryMode(void);
+
+// Send this and every later request through a memfd the server transforms in
+// place (OTP_FLAG_SHARED), one request at a time. Needs an AF_UNIX connection
+void useSharedMemory(void);
+
+// Nonzero if a client's port argument is an AF_UNIX socket path (contains a '/')
+int isLocalAddress(const char *port);
+
+// Connect to a server's AF_UNIX socket, exiting on failure
+int connectLocalServer(const char *path);
+
+// Open a file and measure it, trimming trailing newlines (and spaces if trimSpaces).
+// Prints an error and returns -1 if the file is missing, unreadable or empty
+int openInputFile(const char *filename, int trimSpaces, struct inputFile *file);
+void closeInputFile(struct inputFile *file);
+
+// Stream text and key to the server one segment at a time, writing each reply
+// segment to `out` as it arrives. Exits the process on any error.
+void streamRequest(int socketFD, uint8_t op, struct inputFile *text, struct inputFile *key,
+                   segmentValidator validate, FILE *out);
+
+// Take a fresh key of `length` symbols from a key pool for spec "%pool_name:key_file",
+// save it to key_file for decryption and open that as the key. Prints an error and
+// returns -1 on failure
+int takePoolKey(const char *spec, uint64_t length, struct inputFile *key);
+
+// Port argument that runs a request in this process through libotp (otp_core.h)
+// instead of sending it to a server
+#define OTP_IN_PROCESS "local"
+
+// Segments the in-process mode hands to libotp per batch call
+#define LOCAL_BATCH_JOBS 16
+
+// Nonzero if a client's port argument is OTP_IN_PROCESS
+int isInProcess(const char *port);
+
+// Encrypt or decrypt text with key without a server, writing the result to `out`
+// like streamRequest. Exits the process on any error
+void runLocalRequest(uint8_t op, struct inputFile *text, struct inputFile *key, segmentValidator validate,
+                     FILE *out);
+
+// Parse "@pad_id:offset". Returns -1 if spec is not a pad reference
+int parsePadReference(const char *spec, struct otpPadRef *ref);
+
+// Like streamRequest, but with the key taken from a pad the server holds
+void streamPadRequest(int socketFD, uint8_t op, struct inputFile *text, const struct otpPadRef *pad,
+                      segmentValidator validate, FILE *out);
+
+// Store a pad on the server under padId. Exits the process with the server's error on failure
+void uploadPad(int socketFD, const char *padId, struct inputFile *pad);
+
+// Parse the batch options following argv[0] ("-k"). Returns the index of the first
+// remaining argument, or -1 if the options are invalid
+int parseBatchOptions(int argc, char *argv[], struct batchOptions *options);
+
+// out_dir/NAME for text file .../NAME (allocated)
+char *batchOutputPath(const char *outDir, const char *textFile);
+
+// One request per regular file in options->textDir, in name order
+struct clientRequest *listBatchDirectory(const struct batchOptions *options, size_t *count);
+
+// Send every request over keep-alive connections without waiting for earlier
+// replies, up to OTP_PIPELINE_WINDOW bytes and maxInFlight requests (0 for no
+// limit) ahead on each. With several connections, each pipelines a contiguous
+// share of the requests on its own thread. Replies are written in request order;
+// failed requests print their error to stderr and an empty line to a shared
+// `out`, and leave no output file. Returns the number of requests that failed.
+size_t runBatch(const int *sockets, int connections, uint8_t op, int trimSpaces, size_t maxInFlight,
+                struct clientRequest *requests, size_t count);
+
+#endif
@@ -0,0 +1,42 @@
+#include "otp_core.h"
+#include "otp_protocol.h"
+
+int otpTransform(uint8_t op, uint8_t mode, struct otpJob *job) {
+    if (mode & OTP_FLAG_BINARY) {
+        job->status = xorBytes(job->text, job->key, job->out, job->len); // Its own inverse
+    } else if (mode & OTP_FLAG_PACKED) {
+        const unsigned char *text = (const unsigned char *)job->text;
+        unsigned char *out = (unsigned char *)job->out;
+        job->status = op == OTP_OP_ENCRYPT ? encryptPacked(text, job->key, job->keyPacked, out, job->len)
+                                           : decryptPacked(text, job->key, job->keyPacked, out, job->len);
+    } else {
+        job->status = op == OTP_OP_ENCRYPT ? encryptSymbols(job->text, job->key, job->out, job->len)
+                                           : decryptSymbols(job->text, job->key, job->out, job->len);
+    }
+    return job->status;
+}
+
+size_t otpTransformBatch(uint8_t op, uint8_t mode, struct otpJob *jobs, size_t count) {
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        failed += otpTransform(op, mode, &jobs[i]) != CIPHER_OK;
+    }
+    return failed;
+}
+
+size_t otpEncryptBatch(uint8_t mode, struct otpJob *jobs, size_t count) {
+    return otpTransformBatch(OTP_OP_ENCRYPT, mode, jobs, count);
+}
+
+size_t otpDecryptBatch(uint8_t mode, struct otpJob *jobs, size_t count) {
+    return otpTransformBatch(OTP_OP_DECRYPT, mode, jobs, count);
+}
+
+size_t otpValidateBatch(struct otpJob *jobs, size_t count) {
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        jobs[i].status = validateSymbols(jobs[i].text, jobs[i].len) == 0 ? CIPHER_OK : CIPHER_BAD_TEXT;
+        failed += jobs[i].status != CIPHER_OK;
+    }
+    return failed;
+}
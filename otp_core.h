@@ -0,0 +1,40 @@
+#ifndef OTP_CORE_H
+#define OTP_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "otp_cipher.h"
+
+/*
+ * libotp: the in-process core that both servers and the clients' local mode
+ * (`local` given in place of the port) are built on. It runs the cipher kernels
+ * over buffers the caller owns, one job or a whole batch at a time, and never
+ * allocates, locks or blocks, so it can be called straight from a hot path.
+ *
+ * A job's mode is 0 for plain symbols, OTP_FLAG_PACKED or OTP_FLAG_BINARY (see
+ * otp_protocol.h); out must hold len bytes, or packedSize(len) in packed mode.
+ */
+
+struct otpJob {
+    const char *text;
+    const char *key;
+    char *out;
+    size_t len;    // Symbols, or bytes in binary mode
+    int keyPacked; // Packed mode: the key is packed like the text (0: len plain symbols)
+    int status;    // Set by each call: CIPHER_OK, CIPHER_BAD_TEXT or CIPHER_BAD_KEY
+};
+
+// Encrypt or decrypt (op is OTP_OP_ENCRYPT or OTP_OP_DECRYPT) one job. Returns its status
+int otpTransform(uint8_t op, uint8_t mode, struct otpJob *job);
+
+// The same for every job in turn. Returns how many of them failed
+size_t otpTransformBatch(uint8_t op, uint8_t mode, struct otpJob *jobs, size_t count);
+size_t otpEncryptBatch(uint8_t mode, struct otpJob *jobs, size_t count);
+size_t otpDecryptBatch(uint8_t mode, struct otpJob *jobs, size_t count);
+
+// Check each job's text (plain symbols) without transforming it; key and out are unused.
+// Returns how many jobs hold a character outside the alphabet
+size_t otpValidateBatch(struct otpJob *jobs, size_t count);
+
+#endif
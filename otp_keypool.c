@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "otp_keypool.h"
+
+#define POOL_WAIT_NS 100000 // How often a client short of key checks again
+
+static void poolPath(const char *name, char *path, size_t size) {
+    snprintf(path, size, "/otp-pool-%s", name);
+}
+
+struct keyPool *createKeyPool(const char *name, uint64_t capacity, int binary) {
+    char path[256];
+    poolPath(name, path, sizeof(path));
+    shm_unlink(path); // Clients still mapping an old pool keep it until they are done
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    size_t size = sizeof(struct keyPool) + capacity;
+    if (ftruncate(fd, (off_t)size) < 0) {
+        close(fd);
+        shm_unlink(path);
+        return NULL;
+    }
+    struct keyPool *pool = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pool == MAP_FAILED) {
+        shm_unlink(path);
+        return NULL;
+    }
+    pool->capacity = capacity;
+    pool->binary = (uint32_t)binary;
+    pool->refiller = (int32_t)getpid();
+    __atomic_store_n(&pool->magic, KEYPOOL_MAGIC, __ATOMIC_RELEASE); // Usable from here on
+    return pool;
+}
+
+struct keyPool *openKeyPool(const char *name) {
+    char path[256];
+    poolPath(name, path, sizeof(path));
+    int fd = shm_open(path, O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    struct keyPool *pool = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size > sizeof(struct keyPool)) {
+        pool = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (pool == MAP_FAILED) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (__atomic_load_n(&pool->magic, __ATOMIC_ACQUIRE) != KEYPOOL_MAGIC ||
+        sizeof(struct keyPool) + pool->capacity > (size_t)info.st_size) {
+        munmap(pool, (size_t)info.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+    return pool;
+}
+
+void removeKeyPool(const char *name) {
+    char path[256];
+    poolPath(name, path, sizeof(path));
+    shm_unlink(path);
+}
+
+char *keyPoolSpace(struct keyPool *pool, size_t *len) {
+    uint64_t head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = pool->tail; // Only the refiller moves it
+    uint64_t room = head + pool->capacity - tail;
+    uint64_t toEnd = pool->capacity - tail % pool->capacity;
+    if (room > toEnd) room = toEnd;
+    if (room < *len) *len = (size_t)room;
+    if (*len > 0) {
+        // Announce the overwrite before making it, so a client still copying the
+        // old symbols can tell (see takeKey)
+        __atomic_store_n(&pool->writing, tail + *len, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+    return pool->data + tail % pool->capacity;
+}
+
+void keyPoolFilled(struct keyPool *pool, size_t len) {
+    __atomic_store_n(&pool->tail, pool->tail + len, __ATOMIC_RELEASE);
+}
+
+int takeKey(struct keyPool *pool, char *key, size_t len) {
+    if (len > pool->capacity) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    for (;;) {
+        uint64_t head = __atomic_load_n(&pool->head, __ATOMIC_RELAXED);
+        uint64_t tail = __atomic_load_n(&pool->tail, __ATOMIC_ACQUIRE);
+        if (tail - head < len) {
+            if (kill(pool->refiller, 0) < 0 && errno == ESRCH) {
+                return -1; // Would wait forever
+            }
+            struct timespec pause = { 0, POOL_WAIT_NS };
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        // The one reservation: whoever moves head past the range owns it
+        if (!__atomic_compare_exchange_n(&pool->head, &head, head + len, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        size_t start = (size_t)(head % pool->capacity);
+        size_t first = len < pool->capacity - start ? len : (size_t)(pool->capacity - start);
+        memcpy(key, pool->data + start, first);
+        memcpy(key + first, pool->data, len - first);
+        // Only if the refiller went all the way round the ring while we copied were
+        // our symbols replaced; then they may be mixed with later ones, so take others
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&pool->writing, __ATOMIC_RELAXED) <= head + pool->capacity) {
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef OTP_KEYPOOL_H
+#define OTP_KEYPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A reserve of pre-generated key material in POSIX shared memory
+ * (/dev/shm/otp-pool-NAME). `keygen -P` creates it and keeps it topped up as a
+ * ring; clients take ranges out of it with a single compare-and-swap, so no two
+ * of them ever get the same symbols and none waits on key generation.
+ *
+ * Positions count symbols since the pool was created and never wrap; position p
+ * lives at data[p % capacity].
+ */
+
+#define KEYPOOL_MAGIC 0x314c4f4f5050544fULL // "OTPPOOL1" in memory order
+
+struct keyPool {
+    uint64_t magic;
+    uint64_t capacity; // Symbols the ring holds
+    uint32_t binary;   // Raw random bytes rather than A-Z and space
+    int32_t refiller;  // Process id of the keygen keeping it full
+    uint64_t head;     // Next position to hand out
+    uint64_t tail;     // Every position below this has been generated
+    uint64_t writing;  // The refiller may be overwriting the positions below writing - capacity
+    char data[];
+};
+
+// Create pool `name` with room for `capacity` symbols, replacing any earlier one
+// of that name. Returns NULL (errno set) on failure
+struct keyPool *createKeyPool(const char *name, uint64_t capacity, int binary);
+
+// Map an existing pool, or NULL (errno set) if there is none
+struct keyPool *openKeyPool(const char *name);
+
+// Remove the pool's name; processes that have it mapped keep using it
+void removeKeyPool(const char *name);
+
+// Refiller: where the next fresh symbols go and how many fit there (at most *len,
+// and never past the end of the ring). *len is 0 while the pool is full.
+// Publish them with keyPoolFilled once written
+char *keyPoolSpace(struct keyPool *pool, size_t *len);
+void keyPoolFilled(struct keyPool *pool, size_t len);
+
+// Copy len symbols that nobody else will ever get into key, waiting for the
+// refiller if the pool is short. Returns -1 (errno set) if len exceeds the
+// capacity or nothing is refilling the pool
+int takeKey(struct keyPool *pool, char *key, size_t len);
+
+#endif
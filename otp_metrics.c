@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "otp_metrics.h"
+
+uint64_t metricCounters[METRIC_COUNTERS];
+uint64_t metricErrors[METRIC_ERRORS];
+struct metricHistogramData metricHistograms[METRIC_HISTOGRAMS];
+
+static const char *counterNames[METRIC_COUNTERS] = {
+    [METRIC_CONNECTIONS] = "otp_connections_total",
+    [METRIC_ACTIVE_CONNECTIONS] = "otp_active_connections",
+    [METRIC_ACCEPT_ERRORS] = "otp_accept_errors_total",
+    [METRIC_REQUESTS_OK] = "otp_requests_total",     // result="ok"
+    [METRIC_REQUESTS_FAILED] = "otp_requests_total", // result="error"
+    [METRIC_BYTES_IN] = "otp_received_bytes_total",
+    [METRIC_BYTES_OUT] = "otp_sent_bytes_total",
+    [METRIC_SYMBOLS] = "otp_symbols_total",
+    [METRIC_JOBS_IN_FLIGHT] = "otp_jobs_in_flight",
+    [METRIC_BUFFER_BYTES] = "otp_buffer_bytes",
+};
+
+static const char *errorNames[METRIC_ERRORS] = {
+    [ERROR_INVALID_INPUT] = "invalid_input",
+    [ERROR_WRONG_OP] = "wrong_op",
+    [ERROR_KEY_TOO_SHORT] = "key_too_short",
+    [ERROR_INVALID_TEXT] = "invalid_text",
+    [ERROR_INVALID_KEY] = "invalid_key",
+    [ERROR_PAD_UNKNOWN] = "pad_unknown",
+    [ERROR_PAD_RANGE] = "pad_range",
+    [ERROR_PAD_STORE] = "pad_store",
+    [ERROR_INTERNAL] = "internal",
+    [ERROR_TOO_LARGE] = "too_large",
+    [ERROR_OVERLOADED] = "overloaded",
+};
+
+static const char *phaseNames[METRIC_HISTOGRAMS] = {
+    [PHASE_REQUEST] = "request",
+    [PHASE_QUEUE] = "queue",
+    [PHASE_CIPHER] = "cipher",
+    [PHASE_WRITE] = "write",
+};
+
+static char metricsLabels[96];
+static int metricsFD, serverListenFD;
+static time_t startTime;
+
+void metricObserve(enum metricHistogram histogram, uint64_t start) {
+    uint64_t elapsed = metricNow() - start;
+    uint64_t micros = elapsed / 1000;
+    int bucket = micros == 0 ? 0 : 64 - __builtin_clzll(micros); // Bucket b holds durations under 2^b us
+    if (bucket > METRIC_BUCKETS) bucket = METRIC_BUCKETS;
+    __atomic_fetch_add(&metricHistograms[histogram].buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metricHistograms[histogram].sumNanoseconds, elapsed, __ATOMIC_RELAXED);
+}
+
+static uint64_t load(const uint64_t *value) {
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+// Gauges have no _total suffix
+static int isGauge(int counter) {
+    return counter == METRIC_ACTIVE_CONNECTIONS || counter == METRIC_JOBS_IN_FLIGHT || counter == METRIC_BUFFER_BYTES;
+}
+
+static void writeMetrics(FILE *out) {
+    const char *labels = metricsLabels;
+
+    for (int i = 0; i < METRIC_COUNTERS; i++) {
+        if (i == METRIC_REQUESTS_OK || i == METRIC_REQUESTS_FAILED) continue;
+        fprintf(out, "# TYPE %s %s\n", counterNames[i], isGauge(i) ? "gauge" : "counter");
+        fprintf(out, "%s{%s} %llu\n", counterNames[i], labels, (unsigned long long)load(&metricCounters[i]));
+    }
+    fprintf(out, "# TYPE otp_requests_total counter\n");
+    fprintf(out, "otp_requests_total{%s,result=\"ok\"} %llu\n", labels,
+            (unsigned long long)load(&metricCounters[METRIC_REQUESTS_OK]));
+    fprintf(out, "otp_requests_total{%s,result=\"error\"} %llu\n", labels,
+            (unsigned long long)load(&metricCounters[METRIC_REQUESTS_FAILED]));
+
+    fprintf(out, "# TYPE otp_errors_total counter\n");
+    for (int i = 0; i < METRIC_ERRORS; i++) {
+        fprintf(out, "otp_errors_total{%s,type=\"%s\"} %llu\n", labels, errorNames[i],
+                (unsigned long long)load(&metricErrors[i]));
+    }
+
+    fprintf(out, "# TYPE otp_phase_seconds histogram\n");
+    for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+        uint64_t cumulative = 0;
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            cumulative += load(&metricHistograms[h].buckets[b]);
+            fprintf(out, "otp_phase_seconds_bucket{%s,phase=\"%s\",le=\"%g\"} %llu\n", labels,
+                    phaseNames[h], (double)(1ull << b) / 1e6, (unsigned long long)cumulative);
+        }
+        cumulative += load(&metricHistograms[h].buckets[METRIC_BUCKETS]);
+        fprintf(out, "otp_phase_seconds_bucket{%s,phase=\"%s\",le=\"+Inf\"} %llu\n", labels,
+                phaseNames[h], (unsigned long long)cumulative);
+        fprintf(out, "otp_phase_seconds_sum{%s,phase=\"%s\"} %.9f\n", labels, phaseNames[h],
+                (double)load(&metricHistograms[h].sumNanoseconds) / 1e9);
+        fprintf(out, "otp_phase_seconds_count{%s,phase=\"%s\"} %llu\n", labels, phaseNames[h],
+                (unsigned long long)cumulative);
+    }
+
+    // For a listening socket the kernel reports the accept queue in tcpi_unacked/tcpi_sacked
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(serverListenFD, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+        fprintf(out, "# TYPE otp_listen_queue gauge\notp_listen_queue{%s} %u\n", labels, info.tcpi_unacked);
+        fprintf(out, "# TYPE otp_listen_backlog gauge\notp_listen_backlog{%s} %u\n", labels, info.tcpi_sacked);
+    }
+    fprintf(out, "# TYPE otp_start_time_seconds gauge\notp_start_time_seconds{%s} %lld\n", labels,
+            (long long)startTime);
+}
+
+// Answer every HTTP request with the current metrics, one connection at a time
+static void *serveMetrics(void *arg) {
+    (void)arg;
+    for (;;) {
+        int fd = accept4(metricsFD, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR) usleep(100000);
+            continue;
+        }
+        struct timeval timeout = { 1, 0 }; // A stuck scraper must not block the next one for long
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        // Read the request head; the path does not matter
+        char request[2048];
+        size_t fill = 0;
+        while (fill < sizeof(request) - 1) {
+            ssize_t n = recv(fd, request + fill, sizeof(request) - 1 - fill, 0);
+            if (n <= 0) break;
+            fill += (size_t)n;
+            request[fill] = '\0';
+            if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) break;
+        }
+
+        char *body = NULL;
+        size_t bodyLen = 0;
+        FILE *out = open_memstream(&body, &bodyLen);
+        if (out != NULL) {
+            writeMetrics(out);
+            fclose(out);
+            char head[160];
+            int headLen = snprintf(head, sizeof(head),
+                                   "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                   "Content-Length: %zu\r\nConnection: close\r\n\r\n", bodyLen);
+            if (send(fd, head, (size_t)headLen, MSG_NOSIGNAL) == headLen) {
+                size_t sent = 0;
+                while (sent < bodyLen) {
+                    ssize_t n = send(fd, body + sent, bodyLen - sent, MSG_NOSIGNAL);
+                    if (n <= 0) break;
+                    sent += (size_t)n;
+                }
+            }
+            free(body);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+int startMetricsServer(int port, const char *serverName, int worker, int listenFD) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Local scrapers only
+
+    // Every series carries the server and worker labels
+    snprintf(metricsLabels, sizeof(metricsLabels), "server=\"%s\",worker=\"%d\"", serverName, worker);
+    serverListenFD = listenFD;
+    startTime = time(NULL);
+    metricsFD = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (metricsFD < 0) return -1;
+    int on = 1;
+    setsockopt(metricsFD, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(metricsFD, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(metricsFD, 16) < 0) {
+        close(metricsFD);
+        return -1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serveMetrics, NULL) != 0) {
+        close(metricsFD);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#ifndef OTP_METRICS_H
+#define OTP_METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Always-on server metrics.
+ *
+ * Counters and histograms are plain integers bumped with relaxed atomics from
+ * the event loop and the workers, so recording costs a few nanoseconds.
+ * startMetricsServer() serves them in Prometheus text format over HTTP from
+ * a thread of its own, away from the event loop.
+ */
+
+enum metricCounter {
+    METRIC_CONNECTIONS,       // Accepted connections
+    METRIC_ACTIVE_CONNECTIONS,// Gauge: open connections
+    METRIC_ACCEPT_ERRORS,
+    METRIC_REQUESTS_OK,
+    METRIC_REQUESTS_FAILED,
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_SYMBOLS,           // Text symbols transformed
+    METRIC_JOBS_IN_FLIGHT,    // Gauge: segments queued for or held by a worker
+    METRIC_BUFFER_BYTES,      // Gauge: segment and reply buffer bytes held by connections
+    METRIC_COUNTERS
+};
+
+// Why a request failed; one counter each
+enum metricError {
+    ERROR_INVALID_INPUT,   // Malformed request
+    ERROR_WRONG_OP,        // Operation this server does not perform
+    ERROR_KEY_TOO_SHORT,
+    ERROR_INVALID_TEXT,
+    ERROR_INVALID_KEY,
+    ERROR_PAD_UNKNOWN,
+    ERROR_PAD_RANGE,       // Out of bounds or already used
+    ERROR_PAD_STORE,       // Upload refused
+    ERROR_INTERNAL,        // Out of memory or I/O failure on our side
+    ERROR_TOO_LARGE,       // Over the server's request size limit
+    ERROR_OVERLOADED,      // Shed by admission control
+    METRIC_ERRORS
+};
+
+// Where time goes
+enum metricHistogram {
+    PHASE_REQUEST, // Header received to last reply byte sent
+    PHASE_QUEUE,   // Segment received to a worker picking it up
+    PHASE_CIPHER,  // Worker time per segment
+    PHASE_WRITE,   // Reply ready to fully sent
+    METRIC_HISTOGRAMS
+};
+
+#define METRIC_BUCKETS 26 // Powers of two from 1us to 2^24us (~17s), plus overflow
+
+struct metricHistogramData {
+    uint64_t buckets[METRIC_BUCKETS + 1];
+    uint64_t sumNanoseconds;
+};
+
+extern uint64_t metricCounters[METRIC_COUNTERS];
+extern uint64_t metricErrors[METRIC_ERRORS];
+extern struct metricHistogramData metricHistograms[METRIC_HISTOGRAMS];
+
+static inline uint64_t metricNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline void metricAdd(enum metricCounter counter, int64_t delta) {
+    __atomic_fetch_add(&metricCounters[counter], (uint64_t)delta, __ATOMIC_RELAXED);
+}
+
+static inline void metricError(enum metricError error) {
+    __atomic_fetch_add(&metricErrors[error], 1, __ATOMIC_RELAXED);
+}
+
+// Record a duration that started at `start` (a metricNow() value)
+void metricObserve(enum metricHistogram histogram, uint64_t start);
+
+// Serve /metrics on 127.0.0.1:port. listenFD is the server's socket, whose
+// accept queue is reported so a filling backlog shows up before clients are dropped
+int startMetricsServer(int port, const char *serverName, int worker, int listenFD);
+
+#endif
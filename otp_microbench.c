@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "otp_cipher.h"
+#include "otp_core.h"
+#include "otp_protocol.h"
+
+/*
+ * Microbenchmarks for the libotp kernels, with no sockets or threads involved.
+ *
+ * Each case runs over the same warm buffers until it has taken at least the
+ * requested time, and reports the mean per call and the symbols per second.
+ * Every implementation this CPU can run is measured, followed by the batch API
+ * on whichever one libotp picked.
+ */
+
+#define BATCH_JOBS 16
+
+static const char *implementations[] = { "scalar", "sse2", "avx2" };
+static const size_t sizes[] = { 64, 1024, 16384, OTP_CHUNK_SIZE, 1048576 };
+#define MAX_SIZE 1048576
+
+static char *text, *key, *out;
+static unsigned char *packedText, *packedKey, *packedOut;
+static volatile int sink; // Keeps results alive through the optimizer
+
+enum benchCase { CASE_ENCRYPT, CASE_DECRYPT, CASE_VALIDATE, CASE_XOR, CASE_PACK, CASE_UNPACK, CASE_ENCRYPT_PACKED };
+
+static const char *caseNames[] = { "encrypt", "decrypt", "validate", "xor", "pack", "unpack", "encrypt_packed" };
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void randomSymbols(char *buffer, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        int v = rand() % 27;
+        buffer[i] = (v == 26) ? ' ' : 'A' + v;
+    }
+}
+
+static int runCase(const struct cipherKernels *k, enum benchCase which, size_t len) {
+    switch (which) {
+    case CASE_ENCRYPT: return k->encrypt(text, key, out, len);
+    case CASE_DECRYPT: return k->decrypt(text, key, out, len);
+    case CASE_VALIDATE: return k->validate(text, len);
+    case CASE_XOR: return k->xorBytes(text, key, out, len);
+    case CASE_PACK: packSymbols(text, packedOut, len); return packedOut[0];
+    case CASE_UNPACK: return unpackSymbols(packedText, out, len);
+    case CASE_ENCRYPT_PACKED: return encryptPacked(packedText, (const char *)packedKey, 1, packedOut, len);
+    }
+    return 0;
+}
+
+static void report(const char *implementation, const char *name, size_t len, uint64_t calls, uint64_t elapsed) {
+    double perCall = (double)elapsed / (double)calls;
+    printf("%-8s %-16s %8zu %12.1f %10.2f\n", implementation, name, len, perCall,
+           (double)len * (double)calls / ((double)elapsed / 1e9) / 1e9);
+}
+
+static void measureKernels(const struct cipherKernels *k, uint64_t budget) {
+    for (int which = CASE_ENCRYPT; which <= CASE_ENCRYPT_PACKED; which++) {
+        if (which >= CASE_PACK && strcmp(k->name, cipherImplementation()) != 0) {
+            continue; // The packed code calls the chosen kernels; measure it once
+        }
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            uint64_t calls = 0, start = now(), elapsed;
+            do {
+                for (int i = 0; i < 16; i++) sink += runCase(k, (enum benchCase)which, sizes[s]);
+                calls += 16;
+            } while ((elapsed = now() - start) < budget);
+            report(k->name, caseNames[which], sizes[s], calls, elapsed);
+        }
+    }
+}
+
+// BATCH_JOBS segments of len symbols per call, the shape the servers and local mode use
+static void measureBatch(uint64_t budget) {
+    struct otpJob jobs[BATCH_JOBS];
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t len = sizes[s] / BATCH_JOBS > 0 ? sizes[s] / BATCH_JOBS : 1;
+        for (int j = 0; j < BATCH_JOBS; j++) {
+            struct otpJob job = { text + j * len, key + j * len, out + j * len, len, 0, 0 };
+            jobs[j] = job;
+        }
+        uint64_t calls = 0, start = now(), elapsed;
+        do {
+            sink += (int)otpEncryptBatch(0, jobs, BATCH_JOBS);
+            calls++;
+        } while ((elapsed = now() - start) < budget);
+        report("batch", "encrypt", len * BATCH_JOBS, calls, elapsed);
+
+        calls = 0;
+        start = now();
+        do {
+            sink += (int)otpValidateBatch(jobs, BATCH_JOBS);
+            calls++;
+        } while ((elapsed = now() - start) < budget);
+        report("batch", "validate", len * BATCH_JOBS, calls, elapsed);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 0.2;
+    if (argc > 2 || seconds <= 0) {
+        fprintf(stderr, "USAGE: %s [seconds_per_case]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t budget = (uint64_t)(seconds * 1e9);
+
+    text = malloc(MAX_SIZE);
+    key = malloc(MAX_SIZE);
+    out = malloc(MAX_SIZE);
+    packedText = malloc(packedSize(MAX_SIZE));
+    packedKey = malloc(packedSize(MAX_SIZE));
+    packedOut = malloc(packedSize(MAX_SIZE));
+    if (text == NULL || key == NULL || out == NULL || packedText == NULL || packedKey == NULL || packedOut == NULL) {
+        fprintf(stderr, "MICROBENCH: ERROR out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    srand(1);
+    randomSymbols(text, MAX_SIZE);
+    randomSymbols(key, MAX_SIZE);
+    packSymbols(text, packedText, MAX_SIZE);
+    packSymbols(key, packedKey, MAX_SIZE);
+
+    printf("libotp kernels, %.2fs per case, chosen implementation %s\n", seconds, cipherImplementation());
+    printf("%-8s %-16s %8s %12s %10s\n", "impl", "kernel", "symbols", "ns/call", "Gsym/s");
+    for (size_t i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++) {
+        const struct cipherKernels *k = cipherKernelsByName(implementations[i]);
+        if (k != NULL) measureKernels(k, budget);
+    }
+    measureBatch(budget);
+    return 0;
+}
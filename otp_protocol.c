@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "otp_protocol.h"
+
+// Big-endian integer helpers for the wire headers
+static void put32(unsigned char *out, uint32_t value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+static uint32_t get32(const unsigned char *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | (uint32_t)in[3];
+}
+
+static void put64(unsigned char *out, uint64_t value) {
+    put32(out, (uint32_t)(value >> 32));
+    put32(out + 4, (uint32_t)value);
+}
+
+static uint64_t get64(const unsigned char *in) {
+    return ((uint64_t)get32(in) << 32) | get32(in + 4);
+}
+
+void encodeRequestHeader(const struct otpRequestHeader *header, unsigned char *out) {
+    put32(out, OTP_MAGIC);
+    out[4] = header->op;
+    out[5] = header->flags;
+    out[6] = 0;
+    out[7] = 0;
+    put64(out + 8, header->length);
+    put64(out + 16, header->keyLength);
+}
+
+int decodeRequestHeader(const unsigned char *in, struct otpRequestHeader *header) {
+    if (get32(in) != OTP_MAGIC) {
+        return -1; // Not one of our clients
+    }
+    header->op = in[4];
+    header->flags = in[5];
+    header->length = get64(in + 8);
+    header->keyLength = get64(in + 16);
+    return 0;
+}
+
+void encodePadRef(const struct otpPadRef *ref, unsigned char *out) {
+    put64(out, ref->offset);
+    memset(out + 8, 0, OTP_PAD_ID_SIZE);
+    memcpy(out + 8, ref->id, strnlen(ref->id, OTP_PAD_ID_SIZE - 1));
+}
+
+void decodePadRef(const unsigned char *in, struct otpPadRef *ref) {
+    ref->offset = get64(in);
+    memcpy(ref->id, in + 8, OTP_PAD_ID_SIZE);
+    ref->id[OTP_PAD_ID_SIZE - 1] = '\0'; // Never trust the peer to terminate it
+}
+
+void encodeFrameHeader(const struct otpFrameHeader *header, unsigned char *out) {
+    out[0] = header->type;
+    out[1] = header->code;
+    out[2] = 0;
+    out[3] = 0;
+    put32(out + 4, header->length);
+}
+
+void decodeFrameHeader(const unsigned char *in, struct otpFrameHeader *header) {
+    header->type = in[0];
+    header->code = in[1];
+    header->length = get32(in + 4);
+}
+
+size_t segmentSymbols(uint64_t remaining, uint8_t flags) {
+    size_t chunk = (flags & OTP_FLAG_PACKED) ? OTP_PACKED_CHUNK_SIZE : OTP_CHUNK_SIZE;
+    return remaining < chunk ? (size_t)remaining : chunk;
+}
+
+uint64_t wireBytes(uint64_t symbols, uint8_t flags) {
+    return (flags & OTP_FLAG_PACKED) ? (symbols + 4) / 5 * 3 : symbols; // See packedSize in otp_cipher.h
+}
+
+ssize_t recvAll(int socketFD, void *buffer, size_t len) {
+    size_t received = 0;
+    while (received < len) {
+        ssize_t n = recv(socketFD, (char *)buffer + received, len - received, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue; // Retry if interrupted
+            return -1;
+        }
+        if (n == 0) {
+            return received == 0 ? 0 : -1; // Peer closed, possibly mid-message
+        }
+        received += (size_t)n;
+    }
+    return (ssize_t)len;
+}
+
+int sendAll(int socketFD, const void *buffer, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(socketFD, (const char *)buffer + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue; // Retry if interrupted
+            return -1;
+        }
+        sent += (size_t)n;
+    }
+    return 0;
+}
+
+int sendWithDescriptor(int socketFD, const void *buffer, size_t len, int fd) {
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec part = { (void *)buffer, len };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    memset(&control, 0, sizeof(control));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t n;
+    do {
+        n = sendmsg(socketFD, &message, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return -1;
+    }
+    // The descriptor went with the first byte; the rest is plain data
+    return sendAll(socketFD, (const char *)buffer + n, len - (size_t)n);
+}
+
+// Send every byte described by an iovec array, advancing it past partial writes
+static int sendVector(int socketFD, struct iovec *parts, size_t count) {
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = count;
+
+    while (message.msg_iovlen > 0) {
+        ssize_t n = sendmsg(socketFD, &message, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue; // Retry if interrupted
+            return -1;
+        }
+
+        // Advance the iovec past whatever the kernel accepted
+        while (message.msg_iovlen > 0 && (size_t)n >= message.msg_iov->iov_len) {
+            n -= (ssize_t)message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0) {
+            message.msg_iov->iov_base = (char *)message.msg_iov->iov_base + n;
+            message.msg_iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+int sendFrame(int socketFD, uint8_t type, const void *payload, uint32_t length) {
+    unsigned char header[OTP_FRAME_HEADER_SIZE];
+    struct otpFrameHeader frame = { .type = type, .length = length, .code = 0 };
+    encodeFrameHeader(&frame, header);
+
+    // Gather header and payload into one syscall where possible
+    struct iovec parts[2] = {
+        { header, sizeof(header) },
+        { (void *)payload, length }
+    };
+    return sendVector(socketFD, parts, length > 0 ? 2 : 1);
+}
+
+int sendSegment(int socketFD, const char *text, const char *key, size_t len) {
+    struct iovec parts[2] = {
+        { (void *)text, len },
+        { (void *)key, len }
+    };
+    return sendVector(socketFD, parts, 2);
+}
@@ -0,0 +1,163 @@
+#ifndef OTP_PROTOCOL_H
+#define OTP_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Wire protocol shared by the clients and servers.
+ *
+ * A request starts with a fixed 24-byte header (all integers big-endian):
+ *
+ *   uint32 magic      OTP_MAGIC
+ *   uint8  op         OTP_OP_ENCRYPT, OTP_OP_DECRYPT or OTP_OP_STORE_PAD
+ *   uint8  flags      OTP_FLAG_* bits
+ *   uint16 reserved   must be 0
+ *   uint64 length     number of text symbols that follow
+ *   uint64 keyLength  length of the client's key (must be >= length)
+ *
+ * With OTP_FLAG_PAD the key is not sent at all: the header is followed by a
+ * 40-byte pad reference naming a pad the server already holds, and keyLength
+ * is ignored:
+ *
+ *   uint64 offset     first pad symbol to use
+ *   char   id[32]     pad ID, NUL-padded
+ *
+ * The request then uses pad symbols [offset, offset + length). enc_server
+ * refuses any range that overlaps one it has used before.
+ *
+ * The body is a sequence of segments of at most OTP_CHUNK_SIZE symbols.
+ * Each segment carries n text bytes immediately followed by the n key bytes
+ * that line up with them, so the server never needs more than one segment in
+ * memory. Only the first `length` key bytes are ever sent. Requests that use
+ * a pad send the text bytes alone.
+ *
+ * OTP_OP_STORE_PAD uploads a pad (offset 0, always with OTP_FLAG_PAD): its
+ * body is `length` key symbols in segments without any text, and the server
+ * answers with a single END frame once the pad is stored, or an ERROR frame.
+ *
+ * With OTP_FLAG_PACKED, text and key bytes travel in the packed form of
+ * otp_cipher.h (5 symbols in 3 bytes) and so does every DATA payload. Lengths
+ * still count symbols, segments hold at most OTP_PACKED_CHUNK_SIZE of them (a
+ * whole number of groups), and n symbols take wireBytes(n, flags) bytes.
+ *
+ * With OTP_FLAG_BINARY, text and key are arbitrary bytes and the cipher is
+ * their XOR, the same in both directions. Nothing is validated, and such
+ * requests can be neither packed nor use a pad (pads hold symbols).
+ *
+ * With OTP_FLAG_SHARED (AF_UNIX connections only) no body is sent either:
+ * the header carries a memfd as SCM_RIGHTS ancillary data, sealed against
+ * shrinking, that holds the text at offset 0 followed by the key (unless a
+ * pad supplies it), both laid out as they would be on the wire. The server
+ * transforms the text in place and answers with a lone END or ERROR frame;
+ * on END the memfd holds the reply where the text was.
+ *
+ * The server answers every segment with one DATA frame and finishes with an
+ * END frame. Any failure is reported with an ERROR frame whose payload is a
+ * human-readable message and whose code byte says what went wrong (an
+ * OTP_ERROR_* value); the ERROR frame ends that request's response. A client
+ * told OTP_ERROR_OVERLOADED may send the same request again later.
+ *
+ * The server reads up to OTP_PARALLEL_SEGMENTS segments of a request ahead
+ * of its replies and transforms them in parallel, so a client may keep that
+ * many segments of the request it is sending unanswered without ever
+ * blocking: the server never stops reading them.
+ *
+ * Without OTP_FLAG_KEEPALIVE the server closes the connection after the END or
+ * ERROR frame. With it, the connection stays open and the client may pipeline
+ * further requests back to back; responses come back in request order. A
+ * keep-alive client always sends the complete body of every request, and the
+ * server discards whatever is left of a request it rejected.
+ *
+ *   uint8  type       OTP_FRAME_DATA, OTP_FRAME_END or OTP_FRAME_ERROR
+ *   uint8  code       OTP_ERROR_* for an ERROR frame, else 0
+ *   uint8  reserved[2]
+ *   uint32 length     payload bytes that follow
+ */
+
+#define OTP_MAGIC 0x4F545031u // "OTP1"
+#define OTP_CHUNK_SIZE 65536 // Maximum symbols carried by one segment
+#define OTP_PARALLEL_SEGMENTS 16 // Segments of one request a server reads ahead and processes at once
+
+#define OTP_REQUEST_HEADER_SIZE 24
+#define OTP_FRAME_HEADER_SIZE 8
+
+#define OTP_OP_ENCRYPT 1
+#define OTP_OP_DECRYPT 2
+#define OTP_OP_STORE_PAD 3
+
+#define OTP_PAD_REF_SIZE 40
+#define OTP_PAD_ID_SIZE 32 // Including the terminating NUL
+
+#define OTP_FLAG_KEEPALIVE 0x01 // Keep the connection open for further requests
+#define OTP_FLAG_PAD 0x02       // A pad reference follows the header instead of key bytes
+#define OTP_FLAG_PACKED 0x04    // Text, key and replies use the packed 5-symbols-in-3-bytes form
+#define OTP_FLAG_SHARED 0x08    // Text and key are in a memfd passed with the header
+#define OTP_FLAG_BINARY 0x10    // Text and key are raw bytes, combined with XOR
+#define OTP_KNOWN_FLAGS (OTP_FLAG_KEEPALIVE | OTP_FLAG_PAD | OTP_FLAG_PACKED | OTP_FLAG_SHARED | OTP_FLAG_BINARY)
+
+#define OTP_PACKED_CHUNK_SIZE 65535 // Maximum symbols in one packed segment (a multiple of 5)
+
+#define OTP_FRAME_DATA 0
+#define OTP_FRAME_END 1
+#define OTP_FRAME_ERROR 2
+
+#define OTP_ERROR_UNSPECIFIED 0     // Servers predating error codes
+#define OTP_ERROR_INVALID_REQUEST 1 // Malformed, or flags the server does not support
+#define OTP_ERROR_WRONG_OP 2
+#define OTP_ERROR_KEY_TOO_SHORT 3
+#define OTP_ERROR_INVALID_TEXT 4
+#define OTP_ERROR_INVALID_KEY 5
+#define OTP_ERROR_PAD 6             // Unknown pad, bad or used range, or upload refused
+#define OTP_ERROR_INTERNAL 7
+#define OTP_ERROR_TOO_LARGE 8       // Longer than the server accepts
+#define OTP_ERROR_OVERLOADED 9      // Shed under load: retry later
+
+struct otpRequestHeader {
+    uint8_t op;
+    uint8_t flags;
+    uint64_t length;
+    uint64_t keyLength;
+};
+
+struct otpPadRef {
+    uint64_t offset;
+    char id[OTP_PAD_ID_SIZE];
+};
+
+struct otpFrameHeader {
+    uint8_t type;
+    uint32_t length;
+    uint8_t code; // OTP_ERROR_*
+};
+
+// Serialize/parse the fixed-size headers. decodeRequestHeader returns -1 on a bad magic
+void encodeRequestHeader(const struct otpRequestHeader *header, unsigned char *out);
+int decodeRequestHeader(const unsigned char *in, struct otpRequestHeader *header);
+void encodePadRef(const struct otpPadRef *ref, unsigned char *out);
+void decodePadRef(const unsigned char *in, struct otpPadRef *ref);
+void encodeFrameHeader(const struct otpFrameHeader *header, unsigned char *out);
+void decodeFrameHeader(const unsigned char *in, struct otpFrameHeader *header);
+
+// Symbols in the next segment of a request with `remaining` symbols left to send
+size_t segmentSymbols(uint64_t remaining, uint8_t flags);
+
+// Bytes that `symbols` symbols of text (or key) take on the wire
+uint64_t wireBytes(uint64_t symbols, uint8_t flags);
+
+// Blocking I/O helpers that loop until the whole buffer has been transferred.
+// recvAll returns len on success, 0 on a clean EOF before any byte, -1 otherwise
+ssize_t recvAll(int socketFD, void *buffer, size_t len);
+int sendAll(int socketFD, const void *buffer, size_t len);
+
+// sendAll that passes descriptor fd along with the first byte (AF_UNIX only)
+int sendWithDescriptor(int socketFD, const void *buffer, size_t len, int fd);
+
+// Send one response frame (header plus payload)
+int sendFrame(int socketFD, uint8_t type, const void *payload, uint32_t length);
+
+// Send one request segment: len text bytes followed by the matching len key bytes
+int sendSegment(int socketFD, const char *text, const char *key, size_t len);
+
+#endif
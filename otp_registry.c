@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "otp_cipher.h"
+#include "otp_registry.h"
+
+#define LEDGER_RECORD_SIZE 16 // Big-endian uint64 offset followed by uint64 length
+#define LEDGER_SUFFIX ".used"  // Pad X's ledger is X.used, so no pad may be called that
+
+static char *registryDirectory;
+static struct pad *pads; // Pads mapped so far
+static pthread_mutex_t padsLock = PTHREAD_MUTEX_INITIALIZER; // Guards pads, held while one is mapped
+
+int openPadRegistry(const char *directory) {
+    if (mkdir(directory, 0700) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    struct stat info;
+    if (stat(directory, &info) < 0 || !S_ISDIR(info.st_mode)) {
+        return -1;
+    }
+    registryDirectory = strdup(directory);
+    return registryDirectory != NULL ? 0 : -1;
+}
+
+int padRegistryEnabled(void) {
+    return registryDirectory != NULL;
+}
+
+int validPadId(const char *id) {
+    size_t len = strnlen(id, 32);
+    if (len == 0 || len > 31 || id[0] == '.') {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = id[i];
+        if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+              c == '_' || c == '-' || c == '.')) {
+            return 0;
+        }
+    }
+    // Otherwise an upload could stand in for another pad's ledger and reopen its used ranges
+    size_t suffix = strlen(LEDGER_SUFFIX);
+    return len <= suffix || strcmp(id + len - suffix, LEDGER_SUFFIX) != 0;
+}
+
+// Map and check a pad that is not in the list yet
+static struct pad *loadPad(const char *id) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", registryDirectory, id);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode) || info.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct pad *pad = calloc(1, sizeof(*pad));
+    if (pad == NULL) {
+        munmap(data, (size_t)info.st_size);
+        return NULL;
+    }
+    strcpy(pad->id, id);
+    pad->data = data;
+    pad->length = (uint64_t)info.st_size;
+    while (pad->length > 0 && (pad->data[pad->length - 1] == '\n' || pad->data[pad->length - 1] == '\r')) {
+        pad->length--; // keygen ends every key with a newline
+    }
+    // Checked once here so requests never have to parse the key themselves
+    if (validateSymbols(pad->data, (size_t)pad->length) != 0) {
+        fprintf(stderr, "ERROR: pad %s contains invalid characters\n", id);
+        munmap(data, (size_t)info.st_size);
+        free(pad);
+        return NULL;
+    }
+    pad->ledgerFD = -1;
+    pthread_mutex_init(&pad->lock, NULL);
+    pad->next = pads;
+    pads = pad;
+    return pad;
+}
+
+struct pad *findPad(const char *id) {
+    if (!padRegistryEnabled() || !validPadId(id)) {
+        return NULL;
+    }
+    pthread_mutex_lock(&padsLock);
+    struct pad *pad = pads;
+    while (pad != NULL && strcmp(pad->id, id) != 0) {
+        pad = pad->next;
+    }
+    if (pad == NULL) {
+        pad = loadPad(id); // It may have been added to the directory since startup
+    }
+    pthread_mutex_unlock(&padsLock);
+    return pad;
+}
+
+int checkPadRange(const struct pad *pad, uint64_t offset, uint64_t length) {
+    if (offset > pad->length || length > pad->length - offset) {
+        return PAD_OUT_OF_RANGE;
+    }
+    return PAD_OK;
+}
+
+// Index of the first used range that ends after `offset`
+static size_t firstEndingAfter(const struct pad *pad, uint64_t offset) {
+    size_t low = 0, high = pad->usedCount;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (pad->used[mid].offset + pad->used[mid].length <= offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static int overlapsUsed(const struct pad *pad, uint64_t offset, uint64_t length) {
+    size_t i = firstEndingAfter(pad, offset);
+    return i < pad->usedCount && pad->used[i].offset < offset + length;
+}
+
+// Add a range to the sorted list, merging it with any neighbours it touches
+static int insertUsed(struct pad *pad, uint64_t offset, uint64_t length) {
+    uint64_t end = offset + length;
+    size_t first = firstEndingAfter(pad, offset > 0 ? offset - 1 : 0);
+    size_t last = first;
+    while (last < pad->usedCount && pad->used[last].offset <= end) {
+        if (pad->used[last].offset < offset) offset = pad->used[last].offset;
+        if (pad->used[last].offset + pad->used[last].length > end) end = pad->used[last].offset + pad->used[last].length;
+        last++;
+    }
+
+    if (first == last) {
+        if (pad->usedCount == pad->usedCapacity) {
+            size_t capacity = pad->usedCapacity ? 2 * pad->usedCapacity : 16;
+            struct padRange *used = realloc(pad->used, capacity * sizeof(*used));
+            if (used == NULL) return -1;
+            pad->used = used;
+            pad->usedCapacity = capacity;
+        }
+        memmove(&pad->used[first + 1], &pad->used[first], (pad->usedCount - first) * sizeof(*pad->used));
+        pad->usedCount++;
+    } else {
+        memmove(&pad->used[first + 1], &pad->used[last], (pad->usedCount - last) * sizeof(*pad->used));
+        pad->usedCount -= last - first - 1;
+    }
+    pad->used[first].offset = offset;
+    pad->used[first].length = end - offset;
+    return 0;
+}
+
+static uint64_t get64(const unsigned char *in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value = (value << 8) | in[i];
+    return value;
+}
+
+static void put64(unsigned char *out, uint64_t value) {
+    for (int i = 7; i >= 0; i--) {
+        out[i] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+// Merge ledger records appended by other processes since we last looked. A ledger
+// that is not whole records was torn or tampered with; nothing after the tear can be
+// trusted to line up, so refuse it rather than guess and leave it for an operator
+static int catchUpLedger(struct pad *pad) {
+    struct stat info;
+    if (fstat(pad->ledgerFD, &info) < 0) return -1;
+    uint64_t size = (uint64_t)info.st_size;
+    if (size % LEDGER_RECORD_SIZE != 0 || size < pad->ledgerRead) {
+        fprintf(stderr, "ERROR: pad %s ledger is damaged (%llu bytes); refusing to use the pad\n", pad->id,
+                (unsigned long long)size);
+        return -1;
+    }
+
+    unsigned char records[LEDGER_RECORD_SIZE * 256];
+    while (pad->ledgerRead < size) {
+        uint64_t want = size - pad->ledgerRead;
+        if (want > sizeof(records)) want = sizeof(records);
+        ssize_t n = pread(pad->ledgerFD, records, (size_t)want, (off_t)pad->ledgerRead);
+        if (n < LEDGER_RECORD_SIZE) return -1;
+        n -= n % LEDGER_RECORD_SIZE; // A short read; the rest comes next time round
+        for (ssize_t i = 0; i < n; i += LEDGER_RECORD_SIZE) {
+            if (insertUsed(pad, get64(records + i), get64(records + i + 8)) < 0) return -1;
+        }
+        pad->ledgerRead += (uint64_t)n;
+    }
+    return 0;
+}
+
+// Record a checked, non-empty range in the ledger. The caller holds pad->lock
+static int claimRange(struct pad *pad, uint64_t offset, uint64_t length) {
+    int status;
+    if (pad->ledgerFD < 0) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s" LEDGER_SUFFIX, registryDirectory, pad->id);
+        pad->ledgerFD = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (pad->ledgerFD < 0) return PAD_IO_ERROR;
+    }
+
+    if (flock(pad->ledgerFD, LOCK_EX) < 0) {
+        return PAD_IO_ERROR;
+    }
+    if (catchUpLedger(pad) < 0) {
+        status = PAD_IO_ERROR;
+    } else if (overlapsUsed(pad, offset, length)) {
+        status = PAD_REUSED;
+    } else {
+        unsigned char record[LEDGER_RECORD_SIZE];
+        put64(record, offset);
+        put64(record + 8, length);
+        // Durable before any ciphertext made with this range leaves the server
+        if (write(pad->ledgerFD, record, sizeof(record)) != sizeof(record) || fdatasync(pad->ledgerFD) < 0) {
+            status = PAD_IO_ERROR;
+        } else {
+            pad->ledgerRead += sizeof(record);
+            status = insertUsed(pad, offset, length) < 0 ? PAD_IO_ERROR : PAD_OK;
+        }
+    }
+    flock(pad->ledgerFD, LOCK_UN);
+    return status;
+}
+
+int reservePadRange(struct pad *pad, uint64_t offset, uint64_t length) {
+    int status = checkPadRange(pad, offset, length);
+    if (status != PAD_OK || length == 0) {
+        return status;
+    }
+    pthread_mutex_lock(&pad->lock);
+    status = claimRange(pad, offset, length);
+    pthread_mutex_unlock(&pad->lock);
+    return status;
+}
+
+int beginPadUpload(const char *id, char *tempPath, size_t tempPathSize) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", registryDirectory, id);
+    if (access(path, F_OK) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    snprintf(tempPath, tempPathSize, "%s/.%s.XXXXXX", registryDirectory, id);
+    return mkostemp(tempPath, O_CLOEXEC);
+}
+
+int finishPadUpload(const char *id, const char *tempPath) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", registryDirectory, id);
+    // link() refuses to replace an existing pad, unlike rename()
+    int status = link(tempPath, path);
+    int saved = errno;
+    unlink(tempPath);
+    errno = saved;
+    return status;
+}
+
+const char *padErrorMessage(int status) {
+    switch (status) {
+    case PAD_UNKNOWN: return "ERROR: Unknown pad";
+    case PAD_OUT_OF_RANGE: return "ERROR: Pad range out of bounds";
+    case PAD_REUSED: return "ERROR: Pad range already used";
+    default: return "ERROR: Pad registry unavailable";
+    }
+}
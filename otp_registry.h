@@ -0,0 +1,67 @@
+#ifndef OTP_REGISTRY_H
+#define OTP_REGISTRY_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Server-side key pads.
+ *
+ * Pads live as plain key files (as written by keygen) in one directory, named
+ * by their pad ID, and are mapped read-only on first use. Every range handed
+ * out for encryption is appended to "<id>.used" in the same directory under
+ * an exclusive flock, so a pad segment is never used twice, even across
+ * server restarts or several server processes sharing the directory.
+ *
+ * Mapping a pad and claiming a range both wait on the disk (and on other
+ * servers' ledger locks), so servers call them from worker threads; every
+ * function here may run on several threads at once.
+ */
+
+#define PAD_OK 0
+#define PAD_UNKNOWN -1     // No such pad
+#define PAD_OUT_OF_RANGE -2 // Range runs past the end of the pad
+#define PAD_REUSED -3       // Range overlaps one that was already used
+#define PAD_IO_ERROR -4
+
+struct padRange {
+    uint64_t offset, length;
+};
+
+struct pad {
+    char id[32];
+    const char *data;     // Mapped pad contents
+    uint64_t length;      // Symbols, excluding the trailing newline
+    int ledgerFD;         // Append-only record of used ranges, -1 until needed
+    uint64_t ledgerRead;  // Bytes of the ledger already merged into `used`
+    struct padRange *used; // Sorted, non-overlapping
+    size_t usedCount, usedCapacity;
+    pthread_mutex_t lock; // Serializes reservations; flock does not within a process
+    struct pad *next;
+};
+
+// Serve pads from a directory (creating it if needed). Returns -1 on failure
+int openPadRegistry(const char *directory);
+int padRegistryEnabled(void);
+
+// IDs are 1-31 characters from [A-Za-z0-9_-.], may not start with '.' and may not
+// end in ".used", which names a pad's ledger
+int validPadId(const char *id);
+
+// Look a pad up by ID, mapping it on first use. NULL if it does not exist
+struct pad *findPad(const char *id);
+
+// Claim [offset, offset + length) of a pad for one-time use
+int reservePadRange(struct pad *pad, uint64_t offset, uint64_t length);
+
+// Check that [offset, offset + length) lies inside the pad without claiming it
+int checkPadRange(const struct pad *pad, uint64_t offset, uint64_t length);
+
+// Uploads are written to a hidden temporary file and published atomically
+int beginPadUpload(const char *id, char *tempPath, size_t tempPathSize);
+int finishPadUpload(const char *id, const char *tempPath);
+
+const char *padErrorMessage(int status);
+
+#endif
@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "otp_registry.h"
+
+#define PAD_SYMBOLS 1000
+
+static int failures = 0;
+static char directory[] = "/tmp/otp_registry_test.XXXXXX";
+
+static void check(int condition, const char *what, uint64_t offset, uint64_t length) {
+    if (!condition) {
+        fprintf(stderr, "FAIL %s (offset %llu, length %llu)\n", what, (unsigned long long)offset,
+                (unsigned long long)length);
+        failures++;
+    }
+}
+
+static void expectReserve(struct pad *pad, uint64_t offset, uint64_t length, int expected, const char *what) {
+    check(reservePadRange(pad, offset, length) == expected, what, offset, length);
+}
+
+// The merged used list must be exactly these ranges, in order
+static void expectUsed(const struct pad *pad, const struct padRange *ranges, size_t count, const char *what) {
+    int same = pad->usedCount == count;
+    for (size_t i = 0; same && i < count; i++) {
+        same = pad->used[i].offset == ranges[i].offset && pad->used[i].length == ranges[i].length;
+    }
+    check(same, what, count, pad->usedCount);
+}
+
+static struct pad *createPad(const char *id) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", directory, id);
+    FILE *file = fopen(path, "w");
+    for (int i = 0; i < PAD_SYMBOLS; i++) fputc('A' + i % 26, file);
+    fputc('\n', file);
+    fclose(file);
+    return findPad(id);
+}
+
+// Append raw records to a pad's ledger from a separate process, as another server would
+static void appendFromOtherProcess(const char *id, const struct padRange *ranges, size_t count, size_t tornBytes) {
+    pid_t child = fork();
+    if (child == 0) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s.used", directory, id);
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+        for (size_t i = 0; i < count; i++) {
+            unsigned char record[16];
+            for (int b = 0; b < 8; b++) {
+                record[b] = (unsigned char)(ranges[i].offset >> (56 - 8 * b));
+                record[8 + b] = (unsigned char)(ranges[i].length >> (56 - 8 * b));
+            }
+            if (write(fd, record, sizeof(record)) != sizeof(record)) _exit(1);
+        }
+        if (tornBytes > 0 && write(fd, "\0\0\0\0\0\0\0\0", tornBytes) != (ssize_t)tornBytes) _exit(1);
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "ledger writer", 0, count);
+}
+
+// Touching ranges merge, overlapping and nested ones are refused
+static void testOverlaps(void) {
+    struct pad *pad = createPad("overlaps");
+    expectReserve(pad, 100, 10, PAD_OK, "first range");
+    expectReserve(pad, 110, 10, PAD_OK, "touching after");
+    expectReserve(pad, 90, 10, PAD_OK, "touching before");
+    struct padRange merged[] = { { 90, 30 } };
+    expectUsed(pad, merged, 1, "touching ranges merge");
+
+    expectReserve(pad, 85, 6, PAD_REUSED, "overlaps start");
+    expectReserve(pad, 119, 5, PAD_REUSED, "overlaps end");
+    expectReserve(pad, 95, 10, PAD_REUSED, "nested");
+    expectReserve(pad, 80, 50, PAD_REUSED, "covers");
+    expectReserve(pad, 119, 1, PAD_REUSED, "last used symbol");
+    expectReserve(pad, 89, 1, PAD_OK, "symbol before");
+    expectReserve(pad, 120, 1, PAD_OK, "symbol after");
+    struct padRange grown[] = { { 89, 32 } };
+    expectUsed(pad, grown, 1, "single symbols merge");
+}
+
+// One range filling the gaps between several merges them all into one
+static void testSpanningMerge(void) {
+    struct pad *pad = createPad("spanning");
+    expectReserve(pad, 10, 10, PAD_OK, "a");
+    expectReserve(pad, 30, 10, PAD_OK, "b");
+    expectReserve(pad, 50, 10, PAD_OK, "c");
+    expectReserve(pad, 70, 10, PAD_OK, "d");
+    struct padRange apart[] = { { 10, 10 }, { 30, 10 }, { 50, 10 }, { 70, 10 } };
+    expectUsed(pad, apart, 4, "separate ranges stay apart");
+
+    expectReserve(pad, 20, 10, PAD_OK, "gap a-b");
+    expectReserve(pad, 40, 10, PAD_OK, "gap b-c");
+    struct padRange joined[] = { { 10, 50 }, { 70, 10 } };
+    expectUsed(pad, joined, 2, "gaps filled merge three ranges");
+    expectReserve(pad, 60, 10, PAD_OK, "gap c-d");
+    struct padRange whole[] = { { 10, 70 } };
+    expectUsed(pad, whole, 1, "last gap merges everything");
+    expectReserve(pad, 0, 10, PAD_OK, "touching the merged start");
+}
+
+// Zero-length requests claim nothing, and ranges end exactly at the pad's end
+static void testBounds(void) {
+    struct pad *pad = createPad("bounds");
+    check(pad != NULL && pad->length == PAD_SYMBOLS, "newline trimmed", 0, pad != NULL ? pad->length : 0);
+    expectReserve(pad, 0, 0, PAD_OK, "empty at start");
+    expectReserve(pad, PAD_SYMBOLS, 0, PAD_OK, "empty at end");
+    expectReserve(pad, PAD_SYMBOLS + 1, 0, PAD_OUT_OF_RANGE, "empty past end");
+    check(pad->usedCount == 0 && pad->ledgerFD < 0, "empty requests claim nothing", 0, pad->usedCount);
+
+    expectReserve(pad, PAD_SYMBOLS - 1, 2, PAD_OUT_OF_RANGE, "runs past end");
+    expectReserve(pad, PAD_SYMBOLS, 1, PAD_OUT_OF_RANGE, "starts at end");
+    expectReserve(pad, UINT64_MAX, 2, PAD_OUT_OF_RANGE, "offset overflow");
+    expectReserve(pad, 1, UINT64_MAX, PAD_OUT_OF_RANGE, "length overflow");
+    expectReserve(pad, PAD_SYMBOLS - 1, 1, PAD_OK, "last symbol");
+    expectReserve(pad, PAD_SYMBOLS - 1, 0, PAD_OK, "empty inside a used range");
+    expectReserve(pad, 0, PAD_SYMBOLS, PAD_REUSED, "whole pad after the last symbol");
+    check(checkPadRange(pad, 0, PAD_SYMBOLS) == PAD_OK, "check whole pad", 0, PAD_SYMBOLS);
+}
+
+// Ranges another process recorded are honoured, merged however they fall, and a
+// torn ledger is refused without losing what was already known
+static void testLedgerReload(void) {
+    struct pad *pad = createPad("shared");
+    expectReserve(pad, 0, 10, PAD_OK, "own range");
+
+    struct padRange others[] = { { 100, 10 }, { 120, 10 }, { 140, 10 }, { 105, 40 } };
+    appendFromOtherProcess("shared", others, 4, 0);
+    expectReserve(pad, 125, 1, PAD_REUSED, "range from the other process");
+    struct padRange merged[] = { { 0, 10 }, { 100, 50 } };
+    expectUsed(pad, merged, 2, "overlapping records merged on reload");
+    expectReserve(pad, 10, 90, PAD_OK, "free range between");
+
+    struct padRange late[] = { { 500, 1 } };
+    appendFromOtherProcess("shared", late, 1, 3);
+    expectReserve(pad, 600, 1, PAD_IO_ERROR, "torn ledger refused");
+    expectReserve(pad, 600, 1, PAD_IO_ERROR, "torn ledger stays refused");
+    struct padRange kept[] = { { 0, 150 } };
+    expectUsed(pad, kept, 1, "records before the tear kept");
+}
+
+int main(void) {
+    if (mkdtemp(directory) == NULL || openPadRegistry(directory) < 0) {
+        perror("ERROR creating pad directory");
+        return 1;
+    }
+
+    check(validPadId("pad1") && validPadId("used") && validPadId("a.b"), "valid IDs", 0, 0);
+    check(!validPadId("pad1.used") && !validPadId(".used") && !validPadId(".hidden") && !validPadId(""),
+          "ledger names and hidden files rejected", 0, 0);
+    check(findPad("pad1.used") == NULL, "ledger never served as a pad", 0, 0);
+
+    testOverlaps();
+    testSpanningMerge();
+    testBounds();
+    testLedgerReload();
+    printf(failures == 0 ? "ok   registry\n" : "FAIL registry\n");
+
+    char command[4200];
+    snprintf(command, sizeof(command), "rm -rf %s", directory);
+    if (system(command) != 0) fprintf(stderr, "could not remove %s\n", directory);
+    return failures == 0 ? 0 : 1;
+}
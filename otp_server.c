@@ -0,0 +1,23 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "otp_server_core.h"
+
+#define MAX_CONCURRENT_CONNECTIONS 5 // Maximum number of clients that can connect simultaneously
+
+int main(int argc, char *argv[]) {
+    // Both operations on one port: each request's opcode picks encrypt or decrypt,
+    // with one set of workers, buffers and pads behind them
+    struct serverConfig config = {
+        .name = "otp_server",
+        .op = 0, // Any of OTP_OP_ENCRYPT and OTP_OP_DECRYPT
+        .backlog = MAX_CONCURRENT_CONNECTIONS, // Default listen backlog, -b to change
+        .threads = 0, // One cipher worker per CPU
+        .consumePads = 1 // Encryption never reuses pad symbols; decryption reads them back
+    };
+    parseServerArguments(argc, argv, &config);
+
+    runServer(&config); // Event loop never returns
+    return 0;
+}
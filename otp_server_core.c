@@ -0,0 +1,1652 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "otp_bufpool.h"
+#include "otp_cipher.h"
+#include "otp_core.h"
+#include "otp_metrics.h"
+#include "otp_protocol.h"
+#include "otp_registry.h"
+#include "otp_server_core.h"
+#include "otp_threadpool.h"
+#include "otp_trace.h"
+#include "otp_uring.h"
+
+#define MAX_EVENTS 256 // Events handled per epoll_wait call
+#define ERROR_MESSAGE_SIZE 128 // Room reserved for an error frame
+#define CONTROL_SIZE (2 * OTP_FRAME_HEADER_SIZE + ERROR_MESSAGE_SIZE)
+
+#define QUEUE_SAMPLE_AGE 100000000u // ns after which a queue wait no longer sheds load
+
+#define RING_ENTRIES 1024     // io_uring backend: submission queue size
+#define RING_BUFFERS 1024     // ... receive buffers shared by all connections of a worker
+#define RING_BUFFER_SIZE 16384
+
+// What the receiving side of a connection is doing. Sending runs independently:
+// finished segments are written in order while later ones are still read or processed
+enum connectionState {
+    READ_HEADER,  // Waiting for the request header (and pad reference, if any)
+    ATTACHING_PAD, // A worker is loading the request's pad and claiming its range
+    READ_SEGMENT, // Receiving the next segment, once a slot is free
+    DISCARDING,   // Skipping the rest of a rejected keep-alive request
+    DRAINING      // Whole body received; waiting for the last replies to go out
+};
+
+struct connection;
+
+// io_uring backend: a received buffer not yet consumed by its connection
+struct bufferSpan {
+    unsigned id;
+    size_t len, offset;
+    struct bufferSpan *next;
+};
+
+/*
+ * One segment of a request on its way through the pool. A request keeps up
+ * to OTP_PARALLEL_SEGMENTS of them in a ring, so a large message is read,
+ * transformed on several workers at once and answered in order, all at the
+ * same time. Each segment (64 KiB of text plus key) stays cache-sized.
+ * Slot buffers come from the size-classed pool (otp_bufpool.h), sized to the
+ * request, and go back to it as soon as the request is over.
+ */
+struct segmentSlot {
+    struct poolJob job; // Must stay first: workers get the slot back from the job pointer
+    struct connection *conn;
+    size_t capacity;    // Symbols the buffers hold
+    char *segment;      // Text of len symbols, followed by as much key if inline
+    size_t segmentSize, outSize; // Pool capacities of segment and out
+    char *text;         // Text to transform: in segment, or in the client's shared memory
+    const char *key;
+    size_t len;
+    int last;           // Final segment of the request
+    char *out;          // DATA frame, written by the worker
+    size_t outLen, outSent;
+    int done;           // The worker has handed it back
+    char failure[ERROR_MESSAGE_SIZE]; // Error that ends the request, or empty
+    enum metricError failureKind;
+    uint64_t queuedAt;  // metricNow() when handed to the pool
+    uint64_t readyAt;   // ... when handed back
+    uint64_t requestId; // For tracing
+    size_t held;        // Bytes of it counted in bufferedBytes
+    struct segmentSlot *nextDone;
+};
+
+struct connection {
+    int fd;
+    enum connectionState state;
+    int closeAfterWrite;
+    int keepAlive;      // Client asked to reuse the connection for further requests
+    int closed;         // Socket is gone; freed once the workers return its slots
+    int local;          // Accepted on the AF_UNIX socket, so it may pass shared memory
+
+    unsigned char header[OTP_REQUEST_HEADER_SIZE + OTP_PAD_REF_SIZE];
+    size_t headerFill, headerNeed;
+
+    uint64_t remaining; // Text symbols the client has yet to send
+    uint64_t skip;      // Body bytes of a rejected request still to be discarded
+    size_t segmentLen, segmentFill; // Segment being received
+    size_t bodyWidth;   // Streams in the body: 2 with the key inline, 1 otherwise, 0 if shared
+    uint8_t wireFlags;  // OTP_FLAG_PACKED, OTP_FLAG_SHARED and OTP_FLAG_BINARY as requested
+    uint8_t op;         // The current request's operation
+    void (*run)(struct poolJob *job); // processSegment or storeSegment
+
+    struct segmentSlot *slots;
+    size_t slotCount;
+    size_t depth;       // Slots this request may use
+    uint64_t segmentsRead, segmentsSent; // Slot i holds segment i % depth
+    int jobsInFlight;
+    int requestFailed;  // An error frame ended the request; its remaining segments are dropped
+
+    uint64_t requestStart; // metricNow() when the current request's header arrived
+    uint64_t requestId;    // Numbers this worker's requests in traces
+    uint64_t segmentStart; // metricNow() when the current segment's first bytes arrived (tracing only)
+    int overLimit;         // Accepted past maxConnections: every request is refused
+    int requestDone;       // Final frame of the request is queued
+
+    struct pad *pad;    // Registered pad supplying the key, or NULL (the worker's while ATTACHING_PAD)
+    uint64_t padCursor; // Pad offset of the next segment's key
+    int uploadFD;       // Temporary file receiving an OTP_OP_STORE_PAD body, or -1
+    char *uploadPath;
+    char uploadId[OTP_PAD_ID_SIZE];
+
+    int sharedFD;       // Last memfd the client passed, or -1
+    char *sharedMap;    // sharedFD mapped for the current request, or NULL
+    size_t sharedMapLength;
+    char *sharedText, *sharedKey; // Where the next segment's text and key start
+
+    char control[CONTROL_SIZE]; // END or ERROR frame waiting to be sent
+    size_t controlLen, controlSent;
+
+    // io_uring backend only
+    struct bufferSpan *inHead, *inTail; // Received data waiting to be consumed
+    int peerClosed;     // The receive stream has ended
+    int recvArmed;      // A multishot receive is active
+    int starved;        // ... ended for lack of buffers; rearm once some are free
+    int sendBusy;       // A send is in flight; sendCounter advances when it completes
+    size_t *sendCounter;
+    int closeQueued;    // A close is linked behind the last send
+    int ringOps;        // Submissions that still refer to this connection
+    struct connection *nextStarved;
+};
+
+static const struct serverConfig *config;
+static struct threadPool *pool;
+static int epollFD, listenFD, unixFD = -1, wakeFD;
+
+// io_uring backend state (see serveRing)
+enum ringOp { RING_RECV, RING_SEND, RING_CLOSE, RING_CANCEL }; // Low bits of a connection's user_data
+static struct uring ring;
+static int useRing; // -e uring, until setting up the ring fails
+static struct bufferSpan *spans; // One per provided buffer
+static unsigned buffersHeld;     // Buffers handed to us and not yet recycled
+static struct connection *starvedList; // Receives to rearm once buffers come back
+
+// Admission control (see admitRequest)
+static int openConnections;         // This worker's
+static uint64_t bufferedBytes;      // Received segment bytes held until their reply is sent
+static uint64_t queueWait, queueWaitAt; // Latest wait for a cipher thread and when it ended (workers write)
+
+// Slots handed back by workers, drained by the event loop
+static pthread_mutex_t doneLock = PTHREAD_MUTEX_INITIALIZER;
+static struct segmentSlot *doneList;
+
+static void processSegment(struct poolJob *job);
+
+// Print an error message and exit
+static void fatal(const char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+// Throw away a partly received pad
+static void abortUpload(struct connection *conn) {
+    if (conn->uploadFD >= 0) {
+        close(conn->uploadFD);
+        unlink(conn->uploadPath);
+        conn->uploadFD = -1;
+    }
+    free(conn->uploadPath);
+    conn->uploadPath = NULL;
+}
+
+// Unmap the current request's shared memory once no worker can touch it
+static void releaseShared(struct connection *conn) {
+    if (conn->sharedMap != NULL) {
+        munmap(conn->sharedMap, conn->sharedMapLength);
+        conn->sharedMap = NULL;
+    }
+}
+
+// Hand a slot's buffers back to the pool
+static void releaseBuffers(struct segmentSlot *slot) {
+    metricAdd(METRIC_BUFFER_BYTES, -(int64_t)(slot->segmentSize + slot->outSize));
+    giveBuffer(slot->segment, slot->segmentSize);
+    giveBuffer(slot->out, slot->outSize);
+    slot->segment = slot->out = NULL;
+    slot->segmentSize = slot->outSize = slot->capacity = 0;
+}
+
+// Return every slot's buffers to the pool, so a connection between requests holds
+// none. The slots themselves are kept for the next request unless freeSlots is set
+static void releaseSlots(struct connection *conn, int freeSlots) {
+    for (size_t i = 0; i < conn->slotCount; i++) {
+        releaseBuffers(&conn->slots[i]);
+    }
+    if (freeSlots) {
+        free(conn->slots);
+        conn->slots = NULL;
+        conn->slotCount = 0;
+    }
+}
+
+// Queue a submission about this connection, tagged with what it is
+static struct io_uring_sqe *ringSqe(struct connection *conn, enum ringOp op) {
+    struct io_uring_sqe *sqe = uringGetSqe(&ring);
+    if (sqe == NULL) {
+        fatal("ERROR queueing io_uring submission");
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)conn | op;
+    conn->ringOps++;
+    return sqe;
+}
+
+// Hand every received buffer of a connection back to the kernel
+static void recycleInput(struct connection *conn) {
+    while (conn->inHead != NULL) {
+        uringRecycleBuffer(&ring, conn->inHead->id);
+        buffersHeld--;
+        conn->inHead = conn->inHead->next;
+    }
+    conn->inTail = NULL;
+}
+
+// Close the socket now, but keep the state until no worker holds a slot of it
+// (and, with io_uring, no submission refers to it)
+static void closeConnection(struct connection *conn) {
+    if (!conn->closed) {
+        metricAdd(METRIC_ACTIVE_CONNECTIONS, -1);
+        openConnections--;
+        conn->closed = 1;
+        if (useRing) {
+            recycleInput(conn); // Unread input is of no use any more
+            if (conn->recvArmed) {
+                struct io_uring_sqe *sqe = ringSqe(conn, RING_CANCEL);
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = (uint64_t)(uintptr_t)conn | RING_RECV;
+            }
+            if (!conn->closeQueued) {
+                struct io_uring_sqe *sqe = ringSqe(conn, RING_CLOSE);
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = conn->fd;
+            }
+        } else {
+            close(conn->fd); // Also removes it from the epoll set
+        }
+    }
+    if (conn->jobsInFlight > 0 || conn->ringOps > 0 || conn->starved) {
+        return; // A starved connection is freed when the starved list is next walked
+    }
+    recycleInput(conn);
+    abortUpload(conn);
+    for (size_t i = 0; i < conn->slotCount; i++) {
+        bufferedBytes -= conn->slots[i].held; // Never sent
+    }
+    releaseSlots(conn, 1);
+    releaseShared(conn);
+    if (conn->sharedFD >= 0) close(conn->sharedFD);
+    free(conn);
+}
+
+// Make sure `depth` slots exist, each fitting a segment of `capacity` symbols. Small
+// messages get small buffers, from the pool's smallest class that fits
+static int reserveSlots(struct connection *conn, size_t depth, size_t capacity) {
+    if (depth > conn->slotCount) {
+        struct segmentSlot *slots = realloc(conn->slots, depth * sizeof(*slots));
+        if (slots == NULL) return -1;
+        memset(slots + conn->slotCount, 0, (depth - conn->slotCount) * sizeof(*slots));
+        conn->slots = slots;
+        conn->slotCount = depth;
+    }
+    for (size_t i = 0; i < depth; i++) {
+        struct segmentSlot *slot = &conn->slots[i];
+        slot->conn = conn;
+        if (slot->segment != NULL && capacity <= slot->capacity) continue;
+        releaseBuffers(slot);
+        slot->segment = takeBuffer(capacity > 0 ? 2 * capacity : 1, &slot->segmentSize); // Room for an inline key
+        slot->out = takeBuffer(OTP_FRAME_HEADER_SIZE + capacity, &slot->outSize);
+        metricAdd(METRIC_BUFFER_BYTES, (int64_t)(slot->segmentSize + slot->outSize));
+        if (slot->segment == NULL || slot->out == NULL) {
+            releaseBuffers(slot);
+            return -1;
+        }
+        // Whatever the classes rounded up to is usable by a later, larger request
+        slot->capacity = slot->segmentSize / 2 < slot->outSize - OTP_FRAME_HEADER_SIZE
+                       ? slot->segmentSize / 2 : slot->outSize - OTP_FRAME_HEADER_SIZE;
+    }
+    return 0;
+}
+
+// Bytes of the current segment's body on the wire
+static size_t segmentBytes(const struct connection *conn) {
+    return conn->bodyWidth * (size_t)wireBytes(conn->segmentLen, conn->wireFlags);
+}
+
+// Queue a frame in the control buffer (END, or ERROR with a short message)
+static void appendFrame(struct connection *conn, uint8_t type, uint8_t code, const char *payload, size_t len) {
+    struct otpFrameHeader frame = { type, (uint32_t)len, code };
+    encodeFrameHeader(&frame, (unsigned char *)conn->control + conn->controlLen);
+    if (len > 0) {
+        memcpy(conn->control + conn->controlLen + OTP_FRAME_HEADER_SIZE, payload, len);
+    }
+    conn->controlLen += OTP_FRAME_HEADER_SIZE + len;
+}
+
+// Count a request whose final frame has just been queued. Its latency is
+// recorded once that frame has been sent
+static void finishRequest(struct connection *conn, int failed) {
+    metricAdd(failed ? METRIC_REQUESTS_FAILED : METRIC_REQUESTS_OK, 1);
+    conn->requestDone = 1;
+    conn->closeAfterWrite = !conn->keepAlive;
+}
+
+// What each kind of failure is called on the wire
+static const uint8_t errorCodes[METRIC_ERRORS] = {
+    [ERROR_INVALID_INPUT] = OTP_ERROR_INVALID_REQUEST,
+    [ERROR_WRONG_OP] = OTP_ERROR_WRONG_OP,
+    [ERROR_KEY_TOO_SHORT] = OTP_ERROR_KEY_TOO_SHORT,
+    [ERROR_INVALID_TEXT] = OTP_ERROR_INVALID_TEXT,
+    [ERROR_INVALID_KEY] = OTP_ERROR_INVALID_KEY,
+    [ERROR_PAD_UNKNOWN] = OTP_ERROR_PAD,
+    [ERROR_PAD_RANGE] = OTP_ERROR_PAD,
+    [ERROR_PAD_STORE] = OTP_ERROR_PAD,
+    [ERROR_INTERNAL] = OTP_ERROR_INTERNAL,
+    [ERROR_TOO_LARGE] = OTP_ERROR_TOO_LARGE,
+    [ERROR_OVERLOADED] = OTP_ERROR_OVERLOADED,
+};
+
+// End the current request with an error frame. Segments still in the pool are
+// dropped when they come back, and a kept-alive connection skips the rest of
+// the request body and carries on
+static void failRequest(struct connection *conn, const char *message, enum metricError kind) {
+    metricError(kind);
+    finishRequest(conn, 1);
+    conn->requestFailed = 1;
+    conn->controlLen = 0;
+    conn->controlSent = 0;
+    appendFrame(conn, OTP_FRAME_ERROR, errorCodes[kind], message, strlen(message));
+
+    // Body bytes still on their way, less whatever of the current segment already arrived
+    conn->skip = conn->bodyWidth * wireBytes(conn->remaining, conn->wireFlags);
+    if (conn->state == READ_SEGMENT) conn->skip -= conn->segmentFill;
+    conn->remaining = 0;
+    // Even a connection about to close reads on: closing with unread input would
+    // reset it and could destroy the error frame before the client sees it
+    conn->state = conn->skip > 0 ? DISCARDING : DRAINING;
+}
+
+// Hand a slot back to the event loop
+static void finishJob(struct segmentSlot *slot) {
+    pthread_mutex_lock(&doneLock);
+    slot->nextDone = doneList;
+    doneList = slot;
+    pthread_mutex_unlock(&doneLock);
+
+    uint64_t one = 1;
+    if (write(wakeFD, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fatal("ERROR waking event loop");
+    }
+}
+
+// Worker thread: publish how long the segment it just picked up waited, for admission control
+static void noteQueueWait(uint64_t queuedAt, uint64_t start) {
+    if (config->queueBudget > 0) {
+        __atomic_store_n(&queueWait, start - queuedAt, __ATOMIC_RELAXED);
+        __atomic_store_n(&queueWaitAt, start, __ATOMIC_RELAXED);
+    }
+}
+
+// Worker thread: validate and transform one segment into a DATA frame.
+// Only the slot is written; the connection belongs to the event loop
+static void processSegment(struct poolJob *job) {
+    struct segmentSlot *slot = (struct segmentSlot *)job;
+    const struct connection *conn = slot->conn;
+    size_t n = slot->len;
+
+    metricObserve(PHASE_QUEUE, slot->queuedAt);
+    traceSince(TRACE_QUEUE, slot->requestId, slot->queuedAt);
+    uint64_t start = metricNow();
+    noteQueueWait(slot->queuedAt, start);
+    int shared = (conn->wireFlags & OTP_FLAG_SHARED) != 0;
+    char *result = shared ? slot->text : slot->out + OTP_FRAME_HEADER_SIZE; // Shared text is replaced in place
+    uint8_t mode = conn->wireFlags & (OTP_FLAG_PACKED | OTP_FLAG_BINARY);
+    size_t resultLen = mode == OTP_FLAG_PACKED ? packedSize(n) : n;
+    // Pads are stored as plain symbols; an inline packed key arrives packed like the text
+    struct otpJob cipherJob = { slot->text, slot->key, result, n, conn->pad == NULL, CIPHER_OK };
+    int status = otpTransform(conn->op, mode, &cipherJob);
+    if (status == CIPHER_BAD_TEXT) {
+        snprintf(slot->failure, sizeof(slot->failure), "ERROR: Invalid %s character",
+                 conn->op == OTP_OP_ENCRYPT ? "plaintext" : "ciphertext");
+        slot->failureKind = ERROR_INVALID_TEXT;
+    } else if (status == CIPHER_BAD_KEY) {
+        snprintf(slot->failure, sizeof(slot->failure), "ERROR: Invalid key character");
+        slot->failureKind = ERROR_INVALID_KEY;
+    } else if (shared) {
+        metricAdd(METRIC_SYMBOLS, (int64_t)n); // The client reads the result from its memory after END
+    } else {
+        metricAdd(METRIC_SYMBOLS, (int64_t)n);
+        struct otpFrameHeader frame = { .type = OTP_FRAME_DATA, .length = (uint32_t)resultLen, .code = 0 };
+        encodeFrameHeader(&frame, (unsigned char *)slot->out);
+        slot->outLen = OTP_FRAME_HEADER_SIZE + resultLen;
+    }
+    metricObserve(PHASE_CIPHER, start);
+    traceSince(TRACE_CIPHER, slot->requestId, start);
+
+    finishJob(slot);
+}
+
+// Worker thread: check one segment of an uploaded pad and append it to the temporary file.
+// Uploads use a single slot, so segments arrive here one at a time and in order.
+// Nothing is sent back until the whole pad is stored
+static void storeSegment(struct poolJob *job) {
+    struct segmentSlot *slot = (struct segmentSlot *)job;
+    struct connection *conn = slot->conn;
+    size_t n = slot->len;
+    const char *symbols = slot->segment;
+    const char *failure = NULL;
+    enum metricError kind = ERROR_INTERNAL;
+
+    metricObserve(PHASE_QUEUE, slot->queuedAt);
+    traceSince(TRACE_QUEUE, slot->requestId, slot->queuedAt);
+    uint64_t start = metricNow();
+    noteQueueWait(slot->queuedAt, start);
+    if (conn->wireFlags & OTP_FLAG_PACKED) {
+        // Pads are stored plain; the slot's output buffer is unused and holds a segment
+        char *plain = slot->out;
+        if (unpackSymbols((const unsigned char *)slot->segment, plain, n) == 0) symbols = plain;
+        else symbols = NULL;
+    }
+    if (symbols == NULL || validateSymbols(symbols, n) != 0) {
+        failure = "ERROR: Invalid key character";
+        kind = ERROR_INVALID_KEY;
+    } else {
+        size_t done = 0;
+        while (done < n && failure == NULL) {
+            ssize_t written = write(conn->uploadFD, symbols + done, n - done);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) failure = "ERROR: Pad registry unavailable";
+            else done += (size_t)written;
+        }
+    }
+
+    if (failure == NULL && slot->last) {
+        // Keep the keygen file format, and make the pad durable before it can be used
+        if (write(conn->uploadFD, "\n", 1) != 1 || fsync(conn->uploadFD) < 0) {
+            failure = "ERROR: Pad registry unavailable";
+        } else {
+            close(conn->uploadFD);
+            conn->uploadFD = -1;
+            if (finishPadUpload(conn->uploadId, conn->uploadPath) < 0) {
+                failure = errno == EEXIST ? "ERROR: Pad already exists" : "ERROR: Pad registry unavailable";
+                kind = errno == EEXIST ? ERROR_PAD_STORE : ERROR_INTERNAL;
+            }
+        }
+    }
+    if (failure != NULL) {
+        snprintf(slot->failure, sizeof(slot->failure), "%s", failure);
+        slot->failureKind = kind;
+    }
+    metricObserve(PHASE_CIPHER, start);
+    traceSince(TRACE_CIPHER, slot->requestId, start);
+    if (slot->last || failure != NULL) {
+        abortUpload(conn); // Only the temporary file is left to clean up
+    }
+    finishJob(slot);
+}
+
+// Answer a request that failed its header checks with an error frame,
+// skipping its body of bodySymbols symbols on a kept-alive connection
+static void rejectRequest(struct connection *conn, const char *message, enum metricError kind, uint64_t bodySymbols) {
+    conn->remaining = bodySymbols;
+    failRequest(conn, message, kind);
+}
+
+// Open the temporary file for an OTP_OP_STORE_PAD request. Returns NULL or an error message
+static const char *startUpload(struct connection *conn, const struct otpRequestHeader *request,
+                               const struct otpPadRef *ref) {
+    char path[4096];
+
+    if (!padRegistryEnabled()) {
+        return padErrorMessage(PAD_IO_ERROR);
+    }
+    if (!validPadId(ref->id) || ref->offset != 0) {
+        return "ERROR: Invalid pad ID";
+    }
+    if (request->length == 0) {
+        return "ERROR: Empty pad";
+    }
+    int fd = beginPadUpload(ref->id, path, sizeof(path));
+    if (fd < 0) {
+        return errno == EEXIST ? "ERROR: Pad already exists" : padErrorMessage(PAD_IO_ERROR);
+    }
+    conn->uploadFD = fd;
+    conn->uploadPath = strdup(path);
+    strcpy(conn->uploadId, ref->id);
+    if (conn->uploadPath == NULL) {
+        close(fd);
+        unlink(path);
+        conn->uploadFD = -1;
+        return padErrorMessage(PAD_IO_ERROR);
+    }
+    return NULL;
+}
+
+// Worker thread: resolve the pad a request names and claim (or just check) the range
+// it will use. Mapping a new pad and writing the ledger wait on the disk and on other
+// servers' locks, so they run here rather than stall every connection of the loop.
+// Runs on the request's first slot, which hands the outcome back like a segment
+static void attachPad(struct poolJob *job) {
+    struct segmentSlot *slot = (struct segmentSlot *)job;
+    struct connection *conn = slot->conn;
+    struct otpPadRef ref;
+    int status;
+
+    noteQueueWait(slot->queuedAt, metricNow());
+    decodePadRef(conn->header + OTP_REQUEST_HEADER_SIZE, &ref); // Not received into until the request ends
+    struct pad *pad = padRegistryEnabled() ? findPad(ref.id) : NULL;
+    if (pad == NULL) {
+        status = padRegistryEnabled() ? PAD_UNKNOWN : PAD_IO_ERROR;
+    } else if (config->consumePads && conn->op == OTP_OP_ENCRYPT) {
+        status = reservePadRange(pad, ref.offset, conn->remaining);
+    } else {
+        status = checkPadRange(pad, ref.offset, conn->remaining); // Decrypting reads back used ranges
+    }
+    if (status == PAD_OK) {
+        conn->pad = pad;
+        conn->padCursor = ref.offset;
+    } else {
+        snprintf(slot->failure, sizeof(slot->failure), "%s", padErrorMessage(status));
+        slot->failureKind = status == PAD_UNKNOWN ? ERROR_PAD_UNKNOWN
+                          : status == PAD_IO_ERROR ? ERROR_INTERNAL : ERROR_PAD_RANGE;
+    }
+    finishJob(slot);
+}
+
+// Map the memfd holding a shared request's text and key. Returns NULL or an error message
+static const char *mapShared(struct connection *conn, const struct otpRequestHeader *request, int usesPad) {
+    size_t textBytes = (size_t)wireBytes(request->length, conn->wireFlags);
+    size_t need = usesPad ? textBytes : 2 * textBytes;
+    struct stat info;
+    int seals = conn->sharedFD >= 0 ? fcntl(conn->sharedFD, F_GET_SEALS) : -1;
+
+    // Without the seal the client could shrink the memfd under a worker and crash us
+    if (!conn->local || seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(conn->sharedFD, &info) < 0) {
+        return "ERROR: Shared memory unavailable";
+    }
+    if ((uint64_t)info.st_size < need || wireBytes(request->length, conn->wireFlags) > SIZE_MAX / 2) {
+        return "ERROR: Shared memory too small";
+    }
+    if (need > 0) {
+        void *map = mmap(NULL, need, PROT_READ | PROT_WRITE, MAP_SHARED, conn->sharedFD, 0);
+        if (map == MAP_FAILED) {
+            return "ERROR: Shared memory unavailable";
+        }
+        conn->sharedMap = map;
+        conn->sharedMapLength = need;
+        conn->sharedText = map;
+        conn->sharedKey = conn->sharedText + textBytes;
+    }
+    return NULL;
+}
+
+static uint64_t requestCount; // Requests this worker has started
+
+// Load shedding: refuse a request before any of it is buffered, so that queues
+// and latency stay bounded when traffic spikes. Returns NULL to admit it
+static const char *admitRequest(const struct connection *conn, const struct otpRequestHeader *request,
+                                enum metricError *kind) {
+    *kind = ERROR_OVERLOADED;
+    if (conn->overLimit) {
+        return "ERROR: Server overloaded (too many connections)";
+    }
+    if (config->maxRequest > 0 && request->length > config->maxRequest) {
+        *kind = ERROR_TOO_LARGE;
+        return "ERROR: Request too large";
+    }
+    if (config->maxBuffered > 0 && bufferedBytes >= config->maxBuffered) {
+        return "ERROR: Server overloaded (memory)";
+    }
+    if (config->queueBudget > 0) {
+        // Only a recent sample counts: once the backlog drains, nothing new is measured
+        uint64_t at = __atomic_load_n(&queueWaitAt, __ATOMIC_RELAXED);
+        if (at + QUEUE_SAMPLE_AGE > metricNow() &&
+            __atomic_load_n(&queueWait, __ATOMIC_RELAXED) > (uint64_t)config->queueBudget * 1000000u) {
+            return "ERROR: Server overloaded (queue)";
+        }
+    }
+    return NULL;
+}
+
+// Answer an empty request at once, or start receiving the body's segments
+static void startBody(struct connection *conn) {
+    if (conn->remaining == 0) {
+        appendFrame(conn, OTP_FRAME_END, 0, NULL, 0);
+        finishRequest(conn, 0);
+        conn->state = DRAINING;
+        return;
+    }
+    conn->state = READ_SEGMENT;
+}
+
+// Validate a freshly received header and prepare for the first segment.
+// A header announcing a pad reference just waits for the reference to arrive first
+static void startRequest(struct connection *conn) {
+    struct otpRequestHeader request;
+    struct otpPadRef ref;
+    char message[ERROR_MESSAGE_SIZE];
+
+    if (conn->headerNeed == OTP_REQUEST_HEADER_SIZE) {
+        conn->requestStart = metricNow(); // Not again once a pad reference follows
+        conn->requestId = ++requestCount;
+    }
+    if (decodeRequestHeader(conn->header, &request) < 0) {
+        conn->keepAlive = 0; // Cannot trust anything else this client sends
+        rejectRequest(conn, "ERROR: Invalid input", ERROR_INVALID_INPUT, 0);
+        return;
+    }
+    if (request.flags & ~OTP_KNOWN_FLAGS) {
+        conn->keepAlive = 0; // The body may not be laid out the way we would expect
+        rejectRequest(conn, "ERROR: Unsupported request flags", ERROR_INVALID_INPUT, 0);
+        return;
+    }
+    int usesPad = (request.flags & OTP_FLAG_PAD) != 0;
+    if (usesPad && conn->headerNeed == OTP_REQUEST_HEADER_SIZE) {
+        conn->headerNeed += OTP_PAD_REF_SIZE;
+        return;
+    }
+    conn->keepAlive = (request.flags & OTP_FLAG_KEEPALIVE) != 0;
+    conn->wireFlags = request.flags & (OTP_FLAG_PACKED | OTP_FLAG_SHARED | OTP_FLAG_BINARY);
+    conn->op = request.op;
+    conn->bodyWidth = (conn->wireFlags & OTP_FLAG_SHARED) ? 0 : (usesPad || request.op == OTP_OP_STORE_PAD) ? 1 : 2;
+    conn->pad = NULL;
+    if (usesPad) {
+        decodePadRef(conn->header + OTP_REQUEST_HEADER_SIZE, &ref);
+    }
+    enum metricError refusedAs;
+    const char *refusal = admitRequest(conn, &request, &refusedAs);
+    if (refusal != NULL) {
+        if (conn->overLimit) conn->keepAlive = 0; // Free the connection for someone else
+        rejectRequest(conn, refusal, refusedAs, request.length);
+        return;
+    }
+    if ((conn->wireFlags & OTP_FLAG_BINARY) &&
+        (usesPad || (conn->wireFlags & OTP_FLAG_PACKED) || request.op == OTP_OP_STORE_PAD)) {
+        rejectRequest(conn, "ERROR: Binary requests cannot be packed or use pads", ERROR_INVALID_INPUT,
+                      request.length);
+        return;
+    }
+    if ((conn->wireFlags & OTP_FLAG_SHARED) && request.op != OTP_OP_STORE_PAD) {
+        // Before any pad range is claimed, so nothing is used up by a request that cannot run
+        const char *failure = mapShared(conn, &request, usesPad);
+        if (failure != NULL) {
+            rejectRequest(conn, failure, ERROR_INVALID_INPUT, request.length);
+            return;
+        }
+    }
+
+    if (request.op == OTP_OP_STORE_PAD) {
+        const char *failure = (conn->wireFlags & OTP_FLAG_SHARED) ? "ERROR: Pads cannot be uploaded through shared memory"
+                            : usesPad ? startUpload(conn, &request, &ref) : "ERROR: Invalid pad ID";
+        if (failure != NULL) {
+            rejectRequest(conn, failure, ERROR_PAD_STORE, request.length);
+            return;
+        }
+        conn->run = storeSegment;
+    } else if (config->op != 0 ? request.op != config->op
+                               : request.op != OTP_OP_ENCRYPT && request.op != OTP_OP_DECRYPT) {
+        snprintf(message, sizeof(message), "ERROR: %s cannot process this operation", config->name);
+        rejectRequest(conn, message, ERROR_WRONG_OP, request.length);
+        return;
+    } else if (usesPad) {
+        conn->run = processSegment; // Once attachPad has the pad
+    } else if (request.keyLength < request.length) {
+        rejectRequest(conn, "ERROR: Key too short", ERROR_KEY_TOO_SHORT, request.length);
+        return;
+    } else {
+        conn->run = processSegment;
+    }
+
+    conn->remaining = request.length;
+    conn->segmentLen = segmentSymbols(request.length, conn->wireFlags);
+    conn->segmentFill = 0;
+
+    // Uploads go to the file strictly in order; everything else fans out
+    uint64_t segments = conn->segmentLen > 0 ? (request.length + conn->segmentLen - 1) / conn->segmentLen : 1;
+    conn->depth = conn->run == storeSegment ? 1 : OTP_PARALLEL_SEGMENTS;
+    if (conn->depth > segments) conn->depth = (size_t)segments;
+    size_t capacity = (conn->wireFlags & OTP_FLAG_SHARED) ? 0 : conn->segmentLen; // Shared text needs no buffers
+    if (reserveSlots(conn, conn->depth, capacity) < 0) {
+        metricError(ERROR_INTERNAL);
+        metricAdd(METRIC_REQUESTS_FAILED, 1);
+        abortUpload(conn);
+        conn->requestDone = 1;
+        conn->closeAfterWrite = 1; // Nothing we can send without a buffer
+        conn->state = DRAINING;
+        return;
+    }
+
+    if (usesPad && request.op != OTP_OP_STORE_PAD) {
+        // The body waits until the pad is attached; other connections carry on meanwhile
+        struct segmentSlot *slot = &conn->slots[0];
+        slot->done = 0;
+        slot->failure[0] = '\0';
+        slot->job.run = attachPad;
+        slot->queuedAt = metricNow();
+        slot->requestId = conn->requestId;
+        conn->jobsInFlight++;
+        metricAdd(METRIC_JOBS_IN_FLIGHT, 1);
+        conn->state = ATTACHING_PAD;
+        submitJob(pool, &slot->job);
+        return;
+    }
+    startBody(conn);
+}
+
+// Hand the segment that has just arrived to the pool and get ready for the next
+static void submitSegment(struct connection *conn) {
+    struct segmentSlot *slot = &conn->slots[conn->segmentsRead % conn->depth];
+    conn->remaining -= conn->segmentLen;
+    slot->len = conn->segmentLen;
+    slot->last = conn->remaining == 0;
+    slot->text = slot->segment;
+    if (conn->wireFlags & OTP_FLAG_SHARED) {
+        slot->text = conn->sharedText;
+        slot->key = conn->sharedKey;
+        conn->sharedText += wireBytes(conn->segmentLen, conn->wireFlags);
+        conn->sharedKey += wireBytes(conn->segmentLen, conn->wireFlags);
+    }
+    if (conn->pad != NULL) {
+        slot->key = conn->pad->data + conn->padCursor;
+        conn->padCursor += conn->segmentLen;
+    } else if (!(conn->wireFlags & OTP_FLAG_SHARED)) {
+        slot->key = slot->segment + wireBytes(conn->segmentLen, conn->wireFlags);
+    }
+    slot->done = 0;
+    slot->failure[0] = '\0';
+    slot->outLen = 0;
+    slot->outSent = 0;
+    slot->job.run = conn->run;
+    slot->queuedAt = metricNow();
+    slot->requestId = conn->requestId;
+    slot->held = (conn->wireFlags & OTP_FLAG_SHARED) ? 0 : segmentBytes(conn);
+    bufferedBytes += slot->held;
+    if (!(conn->wireFlags & OTP_FLAG_SHARED)) {
+        traceSince(TRACE_RECV, conn->requestId, conn->segmentStart);
+    }
+    conn->segmentsRead++;
+    conn->jobsInFlight++;
+    metricAdd(METRIC_JOBS_IN_FLIGHT, 1);
+    submitJob(pool, &slot->job);
+
+    if (conn->remaining > 0) {
+        conn->segmentLen = segmentSymbols(conn->remaining, conn->wireFlags);
+        conn->segmentFill = 0;
+    } else {
+        conn->state = DRAINING;
+    }
+}
+
+// io_uring backend: start sending data[*sent, len); *sent advances on completion.
+// The final frame of a request that ends the connection carries the close with it
+static void queueSend(struct connection *conn, const char *data, size_t len, size_t *sent) {
+    int last = conn->closeAfterWrite && conn->requestDone && data == conn->control && conn->state == DRAINING &&
+               conn->jobsInFlight == 0 && conn->segmentsSent == conn->segmentsRead;
+    struct io_uring_sqe *sqe = ringSqe(conn, RING_SEND);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(data + *sent);
+    sqe->len = (uint32_t)(len - *sent);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    conn->sendBusy = 1;
+    conn->sendCounter = sent;
+    if (last) {
+        // All of it must go before the close runs; a failed send cancels the close
+        sqe->msg_flags |= MSG_WAITALL;
+        sqe->flags |= IOSQE_IO_LINK;
+        struct io_uring_sqe *close = ringSqe(conn, RING_CLOSE);
+        close->opcode = IORING_OP_CLOSE;
+        close->fd = conn->fd;
+        conn->closeQueued = 1;
+    }
+}
+
+// Send whatever output is ready, in request order. Returns 1 if anything moved,
+// 0 if there is nothing more to send for now, -1 if the connection was closed
+static int sendOutput(struct connection *conn) {
+    int progress = 0;
+    for (;;) {
+        if (conn->sendBusy) return progress; // io_uring: one send at a time, in order
+        const char *data;
+        size_t len;
+        size_t *sent;
+        struct segmentSlot *slot = NULL;
+
+        if (conn->controlSent < conn->controlLen) {
+            data = conn->control;
+            len = conn->controlLen;
+            sent = &conn->controlSent;
+        } else {
+            if (conn->segmentsSent == conn->segmentsRead) return progress;
+            slot = &conn->slots[conn->segmentsSent % conn->depth];
+            if (!slot->done) return progress; // Replies go out in order
+            if (!conn->requestFailed && slot->failure[0] != '\0') {
+                failRequest(conn, slot->failure, slot->failureKind);
+            }
+            if (conn->requestFailed || slot->outSent == slot->outLen) {
+                // Sent in full, nothing to send (an upload), or dropped after an error
+                if (!conn->requestFailed && slot->outLen > 0) {
+                    metricObserve(PHASE_WRITE, slot->readyAt);
+                    traceSince(TRACE_SEND, conn->requestId, slot->readyAt);
+                }
+                conn->segmentsSent++;
+                bufferedBytes -= slot->held;
+                slot->held = 0;
+                if (!conn->requestFailed && slot->last) {
+                    appendFrame(conn, OTP_FRAME_END, 0, NULL, 0);
+                    finishRequest(conn, 0);
+                }
+                progress = 1;
+                continue;
+            }
+            data = slot->out;
+            len = slot->outLen;
+            sent = &slot->outSent;
+        }
+
+        if (useRing) {
+            queueSend(conn, data, len, sent);
+            return progress;
+        }
+        ssize_t n = send(conn->fd, data + *sent, len - *sent, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return progress;
+        if (n < 0) {
+            closeConnection(conn);
+            return -1;
+        }
+        metricAdd(METRIC_BYTES_OUT, n);
+        *sent += (size_t)n;
+        progress = 1;
+    }
+}
+
+// recv() for either backend: with io_uring, bytes come out of the buffers the
+// multishot receive has already filled
+static ssize_t receiveBytes(struct connection *conn, void *buffer, size_t len) {
+    if (!useRing) {
+        return recv(conn->fd, buffer, len, 0);
+    }
+    size_t done = 0;
+    while (done < len && conn->inHead != NULL) {
+        struct bufferSpan *span = conn->inHead;
+        size_t n = span->len - span->offset < len - done ? span->len - span->offset : len - done;
+        memcpy((char *)buffer + done, uringBuffer(&ring, span->id) + span->offset, n);
+        span->offset += n;
+        done += n;
+        if (span->offset == span->len) {
+            conn->inHead = span->next;
+            if (conn->inHead == NULL) conn->inTail = NULL;
+            uringRecycleBuffer(&ring, span->id);
+            buffersHeld--;
+        }
+    }
+    if (done > 0) return (ssize_t)done;
+    if (conn->peerClosed) return 0;
+    errno = EAGAIN;
+    return -1;
+}
+
+// Receive header bytes, keeping any memfd a local client passes along with them.
+// The io_uring backend receives plain bytes only, so it takes no shared memory
+static ssize_t receiveHeader(struct connection *conn) {
+    void *buffer = conn->header + conn->headerFill;
+    size_t len = conn->headerNeed - conn->headerFill;
+    if (!conn->local || useRing) {
+        return receiveBytes(conn, buffer, len);
+    }
+
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec part = { buffer, len };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+    ssize_t n = recvmsg(conn->fd, &message, MSG_CMSG_CLOEXEC);
+    for (struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&message) : NULL; cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+            if (conn->sharedFD >= 0) close(conn->sharedFD); // Replaced; later requests use the new one
+            memcpy(&conn->sharedFD, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    return n;
+}
+
+// Receive as much as the socket and free slots allow. Returns 1 if anything
+// moved, 0 if blocked, -1 if the connection was closed
+static int receiveInput(struct connection *conn) {
+    static char scratch[OTP_CHUNK_SIZE]; // Sink for skipped bodies (event loop thread only)
+    ssize_t n;
+
+    switch (conn->state) {
+    case READ_HEADER:
+        n = receiveHeader(conn);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+        if (n <= 0) {
+            closeConnection(conn); // Error, or client left between requests
+            return -1;
+        }
+        metricAdd(METRIC_BYTES_IN, n);
+        conn->headerFill += (size_t)n;
+        if (conn->headerFill == conn->headerNeed) {
+            uint64_t start = traceEnabled ? metricNow() : 0;
+            startRequest(conn); // May ask for the pad reference that follows
+            traceSince(TRACE_PARSE, conn->requestId, start);
+        }
+        return 1;
+
+    case ATTACHING_PAD:
+        if (conn->jobsInFlight > 0) {
+            return 0; // The body stays unread until the pad is attached
+        }
+        if (conn->slots[0].failure[0] != '\0') {
+            rejectRequest(conn, conn->slots[0].failure, conn->slots[0].failureKind, conn->remaining);
+        } else {
+            startBody(conn);
+        }
+        return 1;
+
+    case READ_SEGMENT: {
+        if (conn->segmentsRead - conn->segmentsSent >= conn->depth) {
+            return 0; // Every slot is busy; a worker or the sender will free one
+        }
+        if (conn->wireFlags & OTP_FLAG_SHARED) {
+            submitSegment(conn); // Already in memory; nothing to read
+            return 1;
+        }
+        struct segmentSlot *slot = &conn->slots[conn->segmentsRead % conn->depth];
+        n = receiveBytes(conn, slot->segment + conn->segmentFill, segmentBytes(conn) - conn->segmentFill);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+        if (n <= 0) {
+            closeConnection(conn); // Client went away mid-request
+            return -1;
+        }
+        metricAdd(METRIC_BYTES_IN, n);
+        if (traceEnabled && conn->segmentFill == 0) conn->segmentStart = metricNow();
+        conn->segmentFill += (size_t)n;
+        if (conn->segmentFill == segmentBytes(conn)) {
+            submitSegment(conn);
+        }
+        return 1;
+    }
+
+    case DISCARDING:
+        n = receiveBytes(conn, scratch, conn->skip < sizeof(scratch) ? (size_t)conn->skip : sizeof(scratch));
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+        if (n <= 0) {
+            closeConnection(conn);
+            return -1;
+        }
+        metricAdd(METRIC_BYTES_IN, n);
+        conn->skip -= (uint64_t)n;
+        if (conn->skip == 0) {
+            conn->state = DRAINING;
+        }
+        return 1;
+
+    case DRAINING:
+        // The request is over once its final frame is out and no worker holds a slot
+        if (!conn->requestDone || conn->controlSent < conn->controlLen || conn->jobsInFlight > 0 ||
+            conn->segmentsSent < conn->segmentsRead) {
+            return 0;
+        }
+        metricObserve(PHASE_REQUEST, conn->requestStart);
+        traceSince(TRACE_REQUEST, conn->requestId, conn->requestStart);
+        if (conn->closeAfterWrite) {
+            closeConnection(conn);
+            return -1;
+        }
+        releaseSlots(conn, 0);
+        releaseShared(conn);
+        conn->segmentsRead = conn->segmentsSent = 0;
+        conn->requestFailed = 0;
+        conn->requestDone = 0;
+        conn->controlLen = conn->controlSent = 0;
+        conn->headerFill = 0; // A kept-alive client may send another request
+        conn->headerNeed = OTP_REQUEST_HEADER_SIZE;
+        conn->state = READ_HEADER;
+        return 1;
+    }
+    return 0;
+}
+
+// Advance a connection as far as its socket and slots allow without blocking
+static void driveConnection(struct connection *conn) {
+    for (;;) {
+        int sent = sendOutput(conn);
+        if (sent < 0) return;
+        int received = receiveInput(conn);
+        if (received < 0) return;
+        if (!sent && !received) return;
+    }
+}
+
+// State for a freshly accepted socket, or NULL (socket closed) if out of memory
+static struct connection *newConnection(int fd, int local) {
+    struct connection *conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+        close(fd);
+        return NULL;
+    }
+    metricAdd(METRIC_CONNECTIONS, 1);
+    metricAdd(METRIC_ACTIVE_CONNECTIONS, 1);
+    openConnections++;
+    conn->overLimit = config->maxConnections > 0 && openConnections > config->maxConnections;
+    int on = 1; // Replies are written whole; send them without waiting on delayed ACKs
+    if (!local) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    conn->fd = fd;
+    conn->local = local;
+    conn->sharedFD = -1;
+    conn->state = READ_HEADER;
+    conn->headerNeed = OTP_REQUEST_HEADER_SIZE;
+    conn->bodyWidth = 2;
+    conn->uploadFD = -1;
+    conn->run = processSegment;
+    return conn;
+}
+
+// Accept on the TCP socket, or on the AF_UNIX one if local is set
+static void acceptConnections(int local) {
+    for (;;) {
+        int fd = accept4(local ? unixFD : listenFD, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EAGAIN || errno == EINTR || errno == ECONNABORTED) return;
+            metricAdd(METRIC_ACCEPT_ERRORS, 1);
+            perror("ERROR on accept"); // Typically out of descriptors; retry on the next wakeup
+            return;
+        }
+
+        struct connection *conn = newConnection(fd, local);
+        if (conn == NULL) {
+            continue;
+        }
+
+        // Edge-triggered: every handler drains the socket until EAGAIN
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        if (epoll_ctl(epollFD, EPOLL_CTL_ADD, fd, &event) < 0) {
+            closeConnection(conn);
+            continue;
+        }
+        driveConnection(conn); // The request may already be waiting
+    }
+}
+
+// Resume every connection whose segments a worker has finished with.
+// The wakeup counter has already been read
+static void takeCompletions(void) {
+    pthread_mutex_lock(&doneLock);
+    struct segmentSlot *slot = doneList;
+    doneList = NULL;
+    pthread_mutex_unlock(&doneLock);
+
+    while (slot != NULL) {
+        struct segmentSlot *next = slot->nextDone;
+        struct connection *conn = slot->conn;
+        metricAdd(METRIC_JOBS_IN_FLIGHT, -1);
+        slot->done = 1;
+        slot->readyAt = metricNow();
+        conn->jobsInFlight--;
+        if (conn->closed) {
+            closeConnection(conn); // Frees it once the last slot is back
+        } else {
+            driveConnection(conn);
+        }
+        slot = next;
+    }
+}
+
+static void drainCompletions(void) {
+    uint64_t count;
+    if (read(wakeFD, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        fatal("ERROR reading wakeup counter");
+    }
+    takeCompletions();
+}
+
+// Create the listening socket on INADDR_ANY:port. With shared set, several
+// sockets can bind the same port and the kernel spreads connections across them
+static int openListenSocket(int port, int backlog, int shared) {
+    struct sockaddr_in address;
+    memset(&address, '\0', sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port); // Convert port to network byte order
+    address.sin_addr.s_addr = INADDR_ANY; // Accept connections from any IP
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fatal("ERROR opening socket");
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (shared && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        fatal("ERROR enabling SO_REUSEPORT");
+    }
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fatal("ERROR on binding");
+    }
+    if (listen(fd, backlog) < 0) {
+        fatal("ERROR on listen");
+    }
+    return fd;
+}
+
+// Create the AF_UNIX listening socket at path, replacing a stale one left by an earlier run
+static int openUnixSocket(const char *path, int backlog) {
+    struct sockaddr_un address;
+    memset(&address, '\0', sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "ERROR: socket path too long: %s\n", path);
+        exit(1);
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fatal("ERROR opening socket");
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fatal("ERROR on binding");
+    }
+    if (listen(fd, backlog) < 0) {
+        fatal("ERROR on listen");
+    }
+    return fd;
+}
+
+// Tag pointers that distinguish the non-connection descriptors in the epoll set
+static char listenTag, unixTag, wakeTag;
+
+void parseServerArguments(int argc, char *argv[], struct serverConfig *serverConfig) {
+    int option, valid = 1;
+    while ((option = getopt(argc, argv, "P:U:e:m:T:C:M:R:Q:w:t:b:a")) != -1) {
+        switch (option) {
+        case 'w':
+            serverConfig->workers = atoi(optarg);
+            valid = valid && serverConfig->workers > 0;
+            break;
+        case 't':
+            serverConfig->threads = atoi(optarg);
+            valid = valid && serverConfig->threads > 0;
+            break;
+        case 'b':
+            serverConfig->backlog = atoi(optarg);
+            valid = valid && serverConfig->backlog > 0;
+            break;
+        case 'a':
+            serverConfig->pinWorkers = 1;
+            break;
+        case 'P':
+            serverConfig->padDirectory = optarg;
+            break;
+        case 'U':
+            serverConfig->unixPath = optarg;
+            break;
+        case 'e':
+            serverConfig->uring = strcmp(optarg, "uring") == 0;
+            valid = valid && (serverConfig->uring || strcmp(optarg, "epoll") == 0);
+            break;
+        case 'm':
+            serverConfig->metricsPort = atoi(optarg);
+            break;
+        case 'T':
+            serverConfig->tracePath = optarg;
+            break;
+        case 'C':
+            serverConfig->maxConnections = atoi(optarg);
+            valid = valid && serverConfig->maxConnections > 0;
+            break;
+        case 'M':
+            serverConfig->maxBuffered = strtoull(optarg, NULL, 10);
+            valid = valid && serverConfig->maxBuffered > 0;
+            break;
+        case 'R':
+            serverConfig->maxRequest = strtoull(optarg, NULL, 10);
+            valid = valid && serverConfig->maxRequest > 0;
+            break;
+        case 'Q':
+            serverConfig->queueBudget = atoi(optarg);
+            valid = valid && serverConfig->queueBudget > 0;
+            break;
+        default:
+            valid = 0;
+            break;
+        }
+    }
+    if (!valid || optind != argc - 1) {
+        fprintf(stderr, "USAGE: %s [-w workers [-a]] [-t threads] [-b backlog] [-e epoll|uring] [-C max_connections] [-M max_buffered_bytes] [-R max_request_symbols] [-Q queue_budget_ms] [-P pad_directory] [-U socket_path] [-m metrics_port] [-T trace_file] port\n",
+                argv[0]);
+        exit(1);
+    }
+    serverConfig->port = atoi(argv[optind]);
+}
+
+// Pin the calling process to the index-th CPU it is allowed to run on
+static void pinToCpu(int index) {
+    cpu_set_t allowed, chosen;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    int target = index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && target-- == 0) {
+            CPU_ZERO(&chosen);
+            CPU_SET(cpu, &chosen);
+            if (sched_setaffinity(0, sizeof(chosen), &chosen) < 0) {
+                perror("ERROR pinning worker");
+            }
+            return;
+        }
+    }
+}
+
+static void serveEpoll(void);
+static int openRing(void);
+static void serveRing(void);
+
+// Run one event loop on an already listening socket. Never returns
+static void serveForever(int worker, int socketFD) {
+    if (config->pinWorkers) {
+        pinToCpu(worker); // Before the pool starts, so its threads inherit the CPU
+    }
+    if (config->padDirectory != NULL && openPadRegistry(config->padDirectory) < 0) {
+        fatal("ERROR opening pad directory");
+    }
+    if (config->tracePath != NULL) {
+        // Before any thread starts (see startTracing). Each worker dumps to a file of its own
+        char path[4096];
+        if (config->workers > 1) snprintf(path, sizeof(path), "%s.%d", config->tracePath, worker);
+        else snprintf(path, sizeof(path), "%s", config->tracePath);
+        if (startTracing(path) < 0) {
+            fatal("ERROR starting tracing");
+        }
+    }
+
+    // Buffers held past what admission control lets requests use would never be taken again
+    if (config->maxBuffered > 0 && config->maxBuffered < BUFPOOL_DEFAULT_LIMIT) {
+        setBufferPoolLimit((size_t)config->maxBuffered);
+    }
+
+    // Split the CPUs between workers unless told otherwise
+    int threads = config->threads;
+    if (threads <= 0 && config->workers > 1) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = config->pinWorkers ? 1 : (int)(cpus / config->workers);
+        if (threads < 1) threads = 1;
+    }
+    pool = createThreadPool(threads);
+    if (pool == NULL) {
+        fatal("ERROR creating thread pool");
+    }
+
+    listenFD = socketFD;
+    // Each worker keeps its own counters, so each serves them on a port of its own
+    if (config->metricsPort > 0 &&
+        startMetricsServer(config->metricsPort + worker, config->name, worker, listenFD) < 0) {
+        fatal("ERROR starting metrics listener");
+    }
+    wakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFD < 0) {
+        fatal("ERROR creating event loop");
+    }
+    if (useRing && openRing() < 0) {
+        fprintf(stderr, "%s: io_uring unavailable (%s), using epoll\n", config->name, strerror(errno));
+        useRing = 0;
+    }
+    if (useRing) {
+        serveRing();
+    } else {
+        serveEpoll();
+    }
+}
+
+// epoll backend: readiness events, then non-blocking accept, recv and send calls
+static void serveEpoll(void) {
+    epollFD = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFD < 0) {
+        fatal("ERROR creating event loop");
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN; // Level-triggered so a full accept queue is never forgotten
+    event.data.ptr = &listenTag;
+    if (epoll_ctl(epollFD, EPOLL_CTL_ADD, listenFD, &event) < 0) {
+        fatal("ERROR registering listen socket");
+    }
+    if (unixFD >= 0) {
+        // Every worker shares this one; wake just one of them per connection
+        event.events = EPOLLIN | (config->workers > 1 ? EPOLLEXCLUSIVE : 0);
+        event.data.ptr = &unixTag;
+        if (epoll_ctl(epollFD, EPOLL_CTL_ADD, unixFD, &event) < 0) {
+            fatal("ERROR registering unix socket");
+        }
+        event.events = EPOLLIN;
+    }
+    event.data.ptr = &wakeTag;
+    if (epoll_ctl(epollFD, EPOLL_CTL_ADD, wakeFD, &event) < 0) {
+        fatal("ERROR registering wakeup descriptor");
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        int ready = epoll_wait(epollFD, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue; // Retry if interrupted
+            fatal("ERROR on epoll_wait");
+        }
+
+        int woken = 0;
+        for (int i = 0; i < ready; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == &listenTag || tag == &unixTag) {
+                acceptConnections(tag == &unixTag);
+            } else if (tag == &wakeTag) {
+                woken = 1;
+            } else {
+                driveConnection(tag);
+            }
+        }
+
+        // Resume finished connections only after this batch, which may still reference them
+        if (woken) {
+            drainCompletions();
+        }
+    }
+}
+
+/*
+ * io_uring backend. Accepts are multishot, each connection has one multishot
+ * receive drawing from a shared ring of provided buffers, and sends are
+ * submitted one at a time per connection, with the close linked behind the
+ * last one when the connection ends. The connection state machine is the
+ * same as with epoll: receiveBytes serves it from the received buffers, and
+ * sendOutput queues a send instead of calling send().
+ */
+
+static uint64_t wakeCount; // Target of the pending read on wakeFD
+
+static void armAccept(void *tag, int fd) {
+    struct io_uring_sqe *sqe = uringGetSqe(&ring);
+    if (sqe == NULL) {
+        fatal("ERROR queueing io_uring submission");
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (uint64_t)(uintptr_t)tag;
+}
+
+static void armWake(void) {
+    struct io_uring_sqe *sqe = uringGetSqe(&ring);
+    if (sqe == NULL) {
+        fatal("ERROR queueing io_uring submission");
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakeFD;
+    sqe->addr = (uint64_t)(uintptr_t)&wakeCount;
+    sqe->len = sizeof(wakeCount);
+    sqe->user_data = (uint64_t)(uintptr_t)&wakeTag;
+}
+
+static void armReceive(struct connection *conn) {
+    struct io_uring_sqe *sqe = ringSqe(conn, RING_RECV);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    conn->recvArmed = 1;
+}
+
+// A received buffer joins the connection's input queue
+static void queueInput(struct connection *conn, unsigned id, size_t len) {
+    struct bufferSpan *span = &spans[id];
+    span->id = id;
+    span->len = len;
+    span->offset = 0;
+    span->next = NULL;
+    buffersHeld++;
+    if (conn->inTail != NULL) conn->inTail->next = span;
+    else conn->inHead = span;
+    conn->inTail = span;
+    if (conn->closed) recycleInput(conn); // Arrived after the close
+}
+
+static void acceptCompletion(void *tag, int res, unsigned flags) {
+    int local = tag == &unixTag;
+    if (res >= 0) {
+        struct connection *conn = newConnection(res, local);
+        if (conn != NULL) {
+            armReceive(conn);
+        }
+    } else if (res != -ECANCELED && res != -EINTR && res != -ECONNABORTED && res != -EAGAIN) {
+        metricAdd(METRIC_ACCEPT_ERRORS, 1);
+        errno = -res;
+        perror("ERROR on accept"); // Typically out of descriptors
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+        armAccept(tag, local ? unixFD : listenFD);
+    }
+}
+
+static void ringCompletion(uint64_t userData, int res, unsigned flags) {
+    void *tag = (void *)(uintptr_t)userData;
+    if (tag == &listenTag || tag == &unixTag) {
+        acceptCompletion(tag, res, flags);
+        return;
+    }
+    if (tag == &wakeTag) {
+        takeCompletions();
+        armWake();
+        return;
+    }
+
+    struct connection *conn = (struct connection *)(uintptr_t)(userData & ~(uint64_t)3);
+    switch ((enum ringOp)(userData & 3)) {
+    case RING_RECV:
+        if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+            queueInput(conn, flags >> IORING_CQE_BUFFER_SHIFT, (size_t)res);
+        } else if (res == -ENOBUFS) {
+            conn->starved = 1;
+        } else if (res <= 0) {
+            conn->peerClosed = 1; // End of stream, an error or our own cancel
+        }
+        if (!(flags & IORING_CQE_F_MORE)) {
+            conn->recvArmed = 0;
+            conn->ringOps--;
+            if (conn->starved) {
+                conn->nextStarved = starvedList;
+                starvedList = conn;
+            } else if (!conn->peerClosed && !conn->closed) {
+                armReceive(conn); // The kernel ended it for its own reasons
+            }
+        }
+        break;
+    case RING_SEND:
+        conn->ringOps--;
+        conn->sendBusy = 0;
+        if (res > 0 && !conn->closed) {
+            *conn->sendCounter += (size_t)res;
+            metricAdd(METRIC_BYTES_OUT, res);
+        } else if (!conn->closed) {
+            closeConnection(conn);
+        }
+        break;
+    case RING_CLOSE:
+        conn->ringOps--;
+        if (res == -ECANCELED) {
+            close(conn->fd); // The send it was linked to failed
+        }
+        break;
+    case RING_CANCEL:
+        conn->ringOps--;
+        break;
+    }
+
+    if (conn->closed) {
+        closeConnection(conn); // Frees it once nothing refers to it
+    } else {
+        driveConnection(conn);
+    }
+}
+
+// Rearm receives that ran out of buffers, now that some have been recycled
+static void rearmStarved(void) {
+    if (starvedList == NULL || buffersHeld >= RING_BUFFERS) {
+        return;
+    }
+    struct connection *conn = starvedList;
+    starvedList = NULL;
+    while (conn != NULL) {
+        struct connection *next = conn->nextStarved;
+        conn->starved = 0;
+        if (conn->closed) {
+            closeConnection(conn);
+        } else {
+            armReceive(conn);
+        }
+        conn = next;
+    }
+}
+
+// Set up the ring and its buffers, or leave nothing behind so epoll can take over
+static int openRing(void) {
+    if (uringOpen(&ring, RING_ENTRIES) < 0) {
+        return -1;
+    }
+    if (uringProvideBuffers(&ring, RING_BUFFERS, RING_BUFFER_SIZE) < 0) {
+        uringClose(&ring);
+        return -1;
+    }
+    spans = calloc(RING_BUFFERS, sizeof(*spans));
+    if (spans == NULL) {
+        uringClose(&ring);
+        return -1;
+    }
+    return 0;
+}
+
+static void serveRing(void) {
+    armAccept(&listenTag, listenFD);
+    if (unixFD >= 0) {
+        armAccept(&unixTag, unixFD); // Shared by the workers; each accept goes to one ring
+    }
+    armWake();
+
+    for (;;) {
+        if (uringSubmit(&ring, 1) < 0 && errno != EBUSY && errno != EAGAIN) {
+            fatal("ERROR on io_uring_enter");
+        }
+        struct io_uring_cqe *cqe;
+        while ((cqe = uringPeek(&ring)) != NULL) {
+            uint64_t userData = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            uringSeen(&ring);
+            ringCompletion(userData, res, flags);
+        }
+        rearmStarved();
+    }
+}
+
+static volatile sig_atomic_t stopSignal;
+
+static volatile sig_atomic_t dumpSignal;
+
+static void requestStop(int sig) {
+    stopSignal = sig;
+}
+
+static void requestDump(int sig) {
+    dumpSignal = sig;
+}
+
+static pid_t startWorker(int worker, const int *sockets) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        fatal("ERROR forking worker");
+    }
+    if (pid == 0) {
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL); // SIGUSR2 keeps the harmless handler until tracing takes it over
+        for (int i = 0; i < config->workers; i++) {
+            if (i != worker) close(sockets[i]);
+        }
+        serveForever(worker, sockets[worker]);
+    }
+    return pid;
+}
+
+// Prefork mode: one listening socket per worker on the same port (SO_REUSEPORT),
+// so the kernel balances connections and no accept loop is shared. The sockets
+// are created here and outlive any worker, so a crashed worker is restarted
+// without losing the connections queued on its socket
+static void superviseWorkers(void) {
+    int *sockets = calloc((size_t)config->workers, sizeof(*sockets));
+    pid_t *children = calloc((size_t)config->workers, sizeof(*children));
+    if (sockets == NULL || children == NULL) {
+        fatal("ERROR allocating workers");
+    }
+    for (int i = 0; i < config->workers; i++) {
+        sockets[i] = openListenSocket(config->port, config->backlog, 1);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop; // No SA_RESTART: waitpid must return to notice the stop
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    if (config->tracePath != NULL) {
+        action.sa_handler = requestDump; // Passed on to every worker
+        sigaction(SIGUSR2, &action, NULL);
+    }
+
+    for (int i = 0; i < config->workers; i++) {
+        children[i] = startWorker(i, sockets);
+    }
+    while (!stopSignal) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (dumpSignal) {
+            dumpSignal = 0;
+            for (int i = 0; i < config->workers; i++) {
+                kill(children[i], SIGUSR2);
+            }
+        }
+        if (pid < 0) {
+            if (errno == EINTR) continue; // Usually the stop or dump signal
+            fatal("ERROR waiting for workers");
+        }
+        for (int i = 0; i < config->workers; i++) {
+            if (children[i] == pid && !stopSignal) {
+                fprintf(stderr, "%s: worker %d exited (status %d), restarting\n", config->name, i, status);
+                sleep(1); // Don't spin if it dies straight away
+                children[i] = startWorker(i, sockets);
+            }
+        }
+    }
+
+    for (int i = 0; i < config->workers; i++) {
+        kill(children[i], SIGTERM);
+    }
+    while (wait(NULL) > 0 || errno == EINTR);
+    exit(0);
+}
+
+void runServer(const struct serverConfig *serverConfig) {
+    config = serverConfig;
+    useRing = config->uring;
+    if (config->unixPath != NULL) {
+        unixFD = openUnixSocket(config->unixPath, config->backlog); // Inherited by every worker
+    }
+    if (config->workers > 1) {
+        superviseWorkers();
+    }
+    serveForever(0, openListenSocket(config->port, config->backlog, 0));
+}
@@ -0,0 +1,36 @@
+#ifndef OTP_SERVER_CORE_H
+#define OTP_SERVER_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct serverConfig {
+    const char *name;         // Program name used in error messages, e.g. "enc_server"
+    uint8_t op;               // The only operation this server accepts, or 0 for both; run through libotp (otp_core.h)
+    int port;
+    int backlog;              // listen() backlog (per worker)
+    int workers;              // Processes sharing the port through SO_REUSEPORT, <= 1 for one
+    int pinWorkers;           // Pin worker i to the i-th allowed CPU
+    int threads;              // Cipher threads per worker, <= 0 for one per CPU (split between workers)
+    const char *padDirectory; // Serve registered pads from here (NULL to disable)
+    const char *unixPath;     // Also listen on this AF_UNIX socket path, shared by all workers (NULL to disable)
+    int consumePads;          // Refuse to encrypt with any pad range twice
+    int metricsPort;          // Worker i serves Prometheus metrics on 127.0.0.1:metricsPort+i (0 to disable)
+    int uring;                // Run the io_uring backend instead of epoll
+    int maxConnections;       // Per worker: further connections are refused with OTP_ERROR_OVERLOADED (0: no limit)
+    uint64_t maxBuffered;     // Per worker: refuse new requests while segments held in memory exceed this many bytes
+    uint64_t maxRequest;      // Refuse requests longer than this many symbols with OTP_ERROR_TOO_LARGE (0: no limit)
+    int queueBudget;          // Refuse new requests while segments wait longer than this many ms for a cipher thread
+    const char *tracePath;    // Record phase traces, written here on SIGUSR2 (worker i: path.i); NULL to disable
+};
+
+// Fill in port and options from "[-w workers [-a]] [-t threads] [-b backlog] [-e epoll|uring]
+// [-C max_connections] [-M max_buffered_bytes] [-R max_request_symbols] [-Q queue_budget_ms]
+// [-P pad_directory] [-U socket_path] [-m metrics_port] [-T trace_file] port", exiting with a usage message on error
+void parseServerArguments(int argc, char *argv[], struct serverConfig *config);
+
+// Serve requests forever on an epoll (or io_uring) event loop, running cipher work on a thread pool.
+// With several workers, a supervisor process forks them and restarts any that die
+void runServer(const struct serverConfig *config);
+
+#endif
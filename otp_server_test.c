@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "otp_cipher.h"
+#include "otp_protocol.h"
+
+/*
+ * Runs ./enc_server against a scratch pad directory and checks that a request
+ * whose pad range cannot be claimed yet (another server holds the ledger lock)
+ * does not hold up the other connections of the same event loop.
+ */
+
+#define PAD_SYMBOLS 1000
+#define TEXT "HELLO WORLD"
+#define REPLY_TIMEOUT_MS 2000
+
+static int failures = 0;
+static char directory[] = "/tmp/otp_server_test.XXXXXX";
+static char socketPath[128];
+static pid_t server = -1;
+
+static void check(int condition, const char *what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL %s\n", what);
+        failures++;
+    }
+}
+
+static void writePad(const char *path, char *pad) {
+    FILE *file = fopen(path, "w");
+    for (int i = 0; i < PAD_SYMBOLS; i++) pad[i] = 'A' + (i * 7) % 26;
+    fwrite(pad, 1, PAD_SYMBOLS, file);
+    fputc('\n', file);
+    fclose(file);
+}
+
+static void startServer(void) {
+    server = fork();
+    if (server == 0) {
+        // Two cipher threads: one may sit on the ledger lock while the other works
+        execl("./enc_server", "enc_server", "-t", "2", "-P", directory, "-U", socketPath, "0", (char *)NULL);
+        _exit(127);
+    }
+}
+
+// Connect to the server's AF_UNIX socket, waiting for it to come up. -1 on failure
+static int connectServer(void) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    for (int attempt = 0; attempt < 200; attempt++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+            struct timeval timeout = { REPLY_TIMEOUT_MS / 1000, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return fd;
+        }
+        if (fd >= 0) close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+// Send one encryption request, with the key inline or from the pad at offset 0
+static void sendRequest(int fd, const char *padId) {
+    unsigned char header[OTP_REQUEST_HEADER_SIZE + OTP_PAD_REF_SIZE];
+    size_t len = strlen(TEXT);
+    struct otpRequestHeader request = { OTP_OP_ENCRYPT, padId != NULL ? OTP_FLAG_PAD : 0, len, len };
+    encodeRequestHeader(&request, header);
+    size_t headerLen = OTP_REQUEST_HEADER_SIZE;
+    if (padId != NULL) {
+        struct otpPadRef ref = { 0, "" };
+        snprintf(ref.id, sizeof(ref.id), "%s", padId);
+        encodePadRef(&ref, header + headerLen);
+        headerLen += OTP_PAD_REF_SIZE;
+    }
+    int sent = sendAll(fd, header, headerLen);
+    if (padId != NULL) {
+        sent = sent == 0 ? sendAll(fd, TEXT, len) : sent;
+    } else {
+        sent = sent == 0 ? sendSegment(fd, TEXT, TEXT, len) : sent;
+    }
+    check(sent == 0, "request sent");
+}
+
+// Read a DATA frame and the END after it, within REPLY_TIMEOUT_MS. 0 if reply holds them
+static int readReply(int fd, char *reply) {
+    unsigned char header[OTP_FRAME_HEADER_SIZE];
+    struct otpFrameHeader frame;
+    size_t len = strlen(TEXT);
+    if (recvAll(fd, header, sizeof(header)) != sizeof(header)) return -1;
+    decodeFrameHeader(header, &frame);
+    if (frame.type != OTP_FRAME_DATA || frame.length != len || recvAll(fd, reply, len) != (ssize_t)len) return -1;
+    if (recvAll(fd, header, sizeof(header)) != sizeof(header)) return -1;
+    decodeFrameHeader(header, &frame);
+    return frame.type == OTP_FRAME_END ? 0 : -1;
+}
+
+static int replyPending(int fd) {
+    struct pollfd waiting = { fd, POLLIN, 0 };
+    return poll(&waiting, 1, 200) == 0;
+}
+
+int main(void) {
+    char pad[PAD_SYMBOLS], path[4096], reply[sizeof(TEXT)], expected[sizeof(TEXT)];
+    if (mkdtemp(directory) == NULL) {
+        perror("ERROR creating pad directory");
+        return 1;
+    }
+    snprintf(socketPath, sizeof(socketPath), "%s/sock", directory);
+    snprintf(path, sizeof(path), "%s/pad", directory);
+    writePad(path, pad);
+
+    // Stand in for another server sharing the directory, midway through its own reservation
+    snprintf(path, sizeof(path), "%s/pad.used", directory);
+    int ledger = open(path, O_RDWR | O_CREAT, 0600);
+    check(ledger >= 0 && flock(ledger, LOCK_EX) == 0, "ledger locked");
+
+    startServer();
+    int padConnection = connectServer();
+    int plainConnection = connectServer();
+    check(padConnection >= 0 && plainConnection >= 0, "connected");
+    if (padConnection >= 0 && plainConnection >= 0) {
+        sendRequest(padConnection, "pad");
+        check(replyPending(padConnection), "pad request waits for the ledger lock");
+
+        sendRequest(plainConnection, NULL);
+        check(readReply(plainConnection, reply) == 0, "other connection answered while the pad waits");
+        encryptSymbols(TEXT, TEXT, expected, strlen(TEXT));
+        check(memcmp(reply, expected, strlen(TEXT)) == 0, "other connection's ciphertext");
+
+        flock(ledger, LOCK_UN);
+        check(readReply(padConnection, reply) == 0, "pad request answered once the lock is free");
+        encryptSymbols(TEXT, pad, expected, strlen(TEXT));
+        check(memcmp(reply, expected, strlen(TEXT)) == 0, "pad ciphertext");
+        check(lseek(ledger, 0, SEEK_END) == 16, "range recorded in the ledger");
+    }
+    printf(failures == 0 ? "ok   server\n" : "FAIL server\n");
+
+    if (server > 0) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+    char command[4200];
+    snprintf(command, sizeof(command), "rm -rf %s", directory);
+    if (system(command) != 0) fprintf(stderr, "could not remove %s\n", directory);
+    return failures == 0 ? 0 : 1;
+}
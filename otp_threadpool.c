@@ -0,0 +1,72 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "otp_threadpool.h"
+
+struct threadPool {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct poolJob *head, *tail; // FIFO of pending jobs
+    int threads;
+};
+
+// Worker loop: pop jobs in submission order and run them
+static void *workerMain(void *arg) {
+    struct threadPool *pool = arg;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->head == NULL) {
+            pthread_cond_wait(&pool->ready, &pool->lock);
+        }
+        struct poolJob *job = pool->head;
+        pool->head = job->next;
+        if (pool->head == NULL) pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        job->run(job);
+    }
+    return NULL;
+}
+
+struct threadPool *createThreadPool(int threads) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+
+    struct threadPool *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->ready, NULL);
+    pool->threads = threads;
+
+    for (int i = 0; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, workerMain, pool) != 0) {
+            perror("ERROR creating worker thread");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+    return pool;
+}
+
+void submitJob(struct threadPool *pool, struct poolJob *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL) {
+        pool->tail->next = job;
+    } else {
+        pool->head = job;
+    }
+    pool->tail = job;
+    pthread_cond_signal(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int threadPoolSize(const struct threadPool *pool) {
+    return pool->threads;
+}
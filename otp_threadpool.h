@@ -0,0 +1,20 @@
+#ifndef OTP_THREADPOOL_H
+#define OTP_THREADPOOL_H
+
+// A job is embedded in the caller's own state, so submitting never allocates
+struct poolJob {
+    void (*run)(struct poolJob *job);
+    struct poolJob *next;
+};
+
+struct threadPool;
+
+// Start a fixed number of worker threads (<= 0 means one per online CPU)
+struct threadPool *createThreadPool(int threads);
+
+// Queue a job; it runs exactly once on some worker thread
+void submitJob(struct threadPool *pool, struct poolJob *job);
+
+int threadPoolSize(const struct threadPool *pool);
+
+#endif
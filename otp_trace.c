@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "otp_trace.h"
+
+struct traceEvent {
+    uint64_t start, end; // metricNow() values
+    uint64_t request;
+    uint32_t phase;
+};
+
+// Written only by its own thread; count is how many spans it has ever recorded
+struct traceRing {
+    uint64_t count;
+    struct traceEvent events[TRACE_RING_EVENTS];
+    int tid;
+    struct traceRing *next;
+};
+
+int traceEnabled;
+
+static const char *phaseNames[TRACE_PHASES] = { "parse", "recv", "queue", "cipher", "send", "request" };
+
+static __thread struct traceRing *ownRing;
+static struct traceRing *rings; // Every thread's ring, newest first; never shrinks
+static pthread_mutex_t ringsLock = PTHREAD_MUTEX_INITIALIZER;
+static char *tracePath;
+
+static struct traceRing *createRing(void) {
+    struct traceRing *ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->tid = (int)syscall(SYS_gettid);
+    pthread_mutex_lock(&ringsLock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&ringsLock);
+    return ring;
+}
+
+void traceRecord(enum tracePhase phase, uint64_t request, uint64_t start, uint64_t end) {
+    struct traceRing *ring = ownRing;
+    if (ring == NULL && (ring = ownRing = createRing()) == NULL) {
+        return; // Out of memory: go without
+    }
+    uint64_t n = ring->count;
+    struct traceEvent *event = &ring->events[n & (TRACE_RING_EVENTS - 1)];
+    event->start = start;
+    event->end = end;
+    event->request = request;
+    event->phase = (uint32_t)phase;
+    __atomic_store_n(&ring->count, n + 1, __ATOMIC_RELEASE);
+}
+
+// Copy out a ring's spans, dropping any its thread overwrote while we copied
+static size_t snapshotRing(struct traceRing *ring, struct traceEvent *copy) {
+    uint64_t end = __atomic_load_n(&ring->count, __ATOMIC_ACQUIRE);
+    uint64_t first = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+    for (uint64_t i = first; i < end; i++) {
+        copy[i - first] = ring->events[i & (TRACE_RING_EVENTS - 1)];
+    }
+    uint64_t after = __atomic_load_n(&ring->count, __ATOMIC_ACQUIRE);
+    uint64_t valid = after > TRACE_RING_EVENTS ? after - TRACE_RING_EVENTS : 0;
+    if (valid <= first) {
+        return (size_t)(end - first);
+    }
+    if (valid >= end) {
+        return 0;
+    }
+    memmove(copy, copy + (valid - first), (size_t)(end - valid) * sizeof(*copy));
+    return (size_t)(end - valid);
+}
+
+int writeTrace(const char *path) {
+    char temporary[4096];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    struct traceEvent *copy = malloc(TRACE_RING_EVENTS * sizeof(*copy));
+    FILE *out = fopen(temporary, "w");
+    if (copy == NULL || out == NULL) {
+        free(copy);
+        if (out != NULL) fclose(out);
+        return -1;
+    }
+
+    pthread_mutex_lock(&ringsLock);
+    struct traceRing *ring = rings;
+    pthread_mutex_unlock(&ringsLock);
+
+    // Chrome trace format: complete ("X") events in microseconds, one track per thread
+    int pid = (int)getpid();
+    const char *separator = "";
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (; ring != NULL; ring = ring->next) {
+        size_t count = snapshotRing(ring, copy);
+        for (size_t i = 0; i < count; i++) {
+            const struct traceEvent *event = &copy[i];
+            fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"otp\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                         "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%llu}}",
+                    separator, phaseNames[event->phase], pid, ring->tid, event->start / 1000.0,
+                    (event->end - event->start) / 1000.0, (unsigned long long)event->request);
+            separator = ",";
+        }
+    }
+    fprintf(out, "\n]}\n");
+    free(copy);
+
+    if (fclose(out) != 0 || rename(temporary, path) < 0) {
+        unlink(temporary);
+        return -1;
+    }
+    return 0;
+}
+
+static void *dumpOnSignal(void *arg) {
+    sigset_t *signals = arg;
+    for (;;) {
+        int signal;
+        if (sigwait(signals, &signal) == 0 && writeTrace(tracePath) < 0) {
+            perror("ERROR writing trace");
+        }
+    }
+    return NULL;
+}
+
+int startTracing(const char *path) {
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR2);
+    tracePath = strdup(path);
+    if (tracePath == NULL || pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) {
+        return -1;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, dumpOnSignal, &signals) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    traceEnabled = 1;
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef OTP_TRACE_H
+#define OTP_TRACE_H
+
+#include <stdint.h>
+
+#include "otp_metrics.h"
+
+/*
+ * Optional per-request phase tracing.
+ *
+ * Every thread that records spans gets a ring of its own, written without locks
+ * or atomics beyond one release store, so the newest TRACE_RING_EVENTS spans per
+ * thread are always kept. SIGUSR2 writes them all to a file in Chrome trace
+ * (Perfetto) JSON format. While tracing is off, recording is a single branch.
+ */
+
+#define TRACE_RING_EVENTS 65536 // Per thread; a power of two
+
+enum tracePhase {
+    TRACE_PARSE,   // Header decoded and the request set up
+    TRACE_RECV,    // First to last byte of a segment
+    TRACE_QUEUE,   // Segment waiting for a worker
+    TRACE_CIPHER,  // Validation and transform of a segment
+    TRACE_SEND,    // Reply frame ready to fully sent
+    TRACE_REQUEST, // Header received to last reply byte sent
+    TRACE_PHASES
+};
+
+extern int traceEnabled;
+
+// Turn tracing on for this process and dump it to path on every SIGUSR2. Call it
+// before starting any other thread: SIGUSR2 is blocked in the caller, so the threads
+// it starts inherit that and a thread of our own takes the signal instead
+int startTracing(const char *path);
+
+// Record a span that began at start (a metricNow() value) and ends now
+void traceRecord(enum tracePhase phase, uint64_t request, uint64_t start, uint64_t end);
+
+static inline void traceSince(enum tracePhase phase, uint64_t request, uint64_t start) {
+    if (traceEnabled) traceRecord(phase, request, start, metricNow());
+}
+
+// Write every thread's spans to path now. Returns -1 on failure
+int writeTrace(const char *path);
+
+#endif
@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "otp_uring.h"
+
+static int setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int enter(int fd, unsigned submit, unsigned waitFor, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, waitFor, flags, NULL, 0);
+}
+
+static int registerRing(int fd, unsigned opcode, void *arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+// Map one of the ring's regions, or NULL
+static void *mapRing(struct uring *ring, size_t size, off_t offset) {
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, offset);
+    return region != MAP_FAILED ? region : NULL;
+}
+
+int uringOpen(struct uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 4 * entries; // Multishot receives and accepts post many completions per submission
+    // Completion work runs when we wait for it, not as interrupts of the loop
+    params.flags |= IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ring->fd = setup(entries, &params);
+    if (ring->fd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params)); // Kernels before 6.1
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = 4 * entries;
+        ring->fd = setup(entries, &params);
+    }
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+    ring->sqRing = mapRing(ring, ring->sqRingSize, IORING_OFF_SQ_RING);
+    if (ring->sqRing == NULL) {
+        uringClose(ring);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqRing = ring->sqRing;
+    } else if ((ring->cqRing = mapRing(ring, ring->cqRingSize, IORING_OFF_CQ_RING)) == NULL) {
+        uringClose(ring);
+        return -1;
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mapRing(ring, ring->sqesSize, IORING_OFF_SQES);
+    if (ring->sqes == NULL) {
+        uringClose(ring);
+        return -1;
+    }
+
+    char *sq = ring->sqRing, *cq = ring->cqRing;
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->sqEntries = params.sq_entries;
+    ring->sqLocalTail = *ring->sqTail;
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+int uringProvideBuffers(struct uring *ring, unsigned count, unsigned size) {
+    size_t ringBytes = count * sizeof(struct io_uring_buf);
+    size_t memoryBytes = (size_t)count * size;
+    void *buffers = mmap(NULL, ringBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void *memory = mmap(NULL, memoryBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED || memory == MAP_FAILED) {
+        int saved = errno;
+        if (buffers != MAP_FAILED) munmap(buffers, ringBytes);
+        if (memory != MAP_FAILED) munmap(memory, memoryBytes);
+        errno = saved;
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)buffers;
+    reg.ring_entries = count;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (registerRing(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int saved = errno; // EINVAL before Linux 5.19
+        munmap(buffers, ringBytes);
+        munmap(memory, memoryBytes);
+        errno = saved;
+        return -1;
+    }
+    ring->buffers = buffers;
+    ring->bufferMemory = memory;
+    ring->bufferCount = count;
+    ring->bufferSize = size;
+    for (unsigned id = 0; id < count; id++) {
+        uringRecycleBuffer(ring, id);
+    }
+    return 0;
+}
+
+void uringClose(struct uring *ring) {
+    int saved = errno; // Callers report why the ring failed, not how it was torn down
+    if (ring->buffers != NULL) {
+        munmap(ring->buffers, ring->bufferCount * sizeof(struct io_uring_buf));
+        munmap(ring->bufferMemory, (size_t)ring->bufferCount * ring->bufferSize);
+    }
+    if (ring->sqes != NULL) munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != NULL && ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+    if (ring->sqRing != NULL) munmap(ring->sqRing, ring->sqRingSize);
+    if (ring->fd >= 0) close(ring->fd); // Also drops the buffer ring registration
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    errno = saved;
+}
+
+char *uringBuffer(const struct uring *ring, unsigned id) {
+    return ring->bufferMemory + (size_t)id * ring->bufferSize;
+}
+
+void uringRecycleBuffer(struct uring *ring, unsigned id) {
+    struct io_uring_buf *buffer = &ring->buffers->bufs[ring->bufferTail & (ring->bufferCount - 1)];
+    buffer->addr = (uint64_t)(uintptr_t)uringBuffer(ring, id);
+    buffer->len = ring->bufferSize;
+    buffer->bid = (uint16_t)id;
+    ring->bufferTail++;
+    // Publish the entry before the kernel can see the new tail
+    __atomic_store_n(&ring->buffers->tail, ring->bufferTail, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe *uringGetSqe(struct uring *ring) {
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if (ring->sqLocalTail - head >= ring->sqEntries) {
+        uringSubmit(ring, 0);
+        head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+        if (ring->sqLocalTail - head >= ring->sqEntries) return NULL;
+    }
+    unsigned index = ring->sqLocalTail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[index] = index;
+    ring->sqLocalTail++;
+    return sqe;
+}
+
+int uringSubmit(struct uring *ring, unsigned waitFor) {
+    unsigned pending = ring->sqLocalTail - *ring->sqTail;
+    __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+    for (;;) {
+        int n = enter(ring->fd, pending, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (n >= 0 || errno != EINTR) return n;
+        pending = 0; // Whatever was consumed before the signal stays consumed
+    }
+}
+
+struct io_uring_cqe *uringPeek(struct uring *ring) {
+    unsigned head = *ring->cqHead;
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cqMask];
+}
+
+void uringSeen(struct uring *ring) {
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,60 @@
+#ifndef OTP_URING_H
+#define OTP_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/*
+ * A minimal io_uring wrapper on the raw system calls (no liburing): one
+ * submission and completion queue pair, plus one provided buffer ring that
+ * multishot receives pick their buffers from.
+ *
+ * Only the thread that opened a ring may use it.
+ */
+
+struct uring {
+    int fd;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned sqEntries;
+    unsigned sqLocalTail;   // SQEs prepared but not yet published
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+
+    struct io_uring_buf_ring *buffers; // Provided buffer ring, group URING_BUFFER_GROUP
+    char *bufferMemory;
+    unsigned bufferCount, bufferSize;
+    uint16_t bufferTail;
+};
+
+#define URING_BUFFER_GROUP 0
+
+// Set up a ring with room for `entries` submissions. Returns -1 (errno set) on failure,
+// e.g. ENOSYS on kernels without io_uring
+int uringOpen(struct uring *ring, unsigned entries);
+
+// Register `count` (a power of two) receive buffers of `size` bytes each.
+// Returns -1 (errno set, nothing left mapped) on failure
+int uringProvideBuffers(struct uring *ring, unsigned count, unsigned size);
+
+// Unmap and close everything uringOpen and uringProvideBuffers set up
+void uringClose(struct uring *ring);
+
+// Start of provided buffer `id`, and hand it back to the kernel once consumed
+char *uringBuffer(const struct uring *ring, unsigned id);
+void uringRecycleBuffer(struct uring *ring, unsigned id);
+
+// A zeroed SQE to fill in, submitting the queue first if it is full
+struct io_uring_sqe *uringGetSqe(struct uring *ring);
+
+// Submit everything prepared and wait until at least `waitFor` completions are ready
+int uringSubmit(struct uring *ring, unsigned waitFor);
+
+// Next completion, or NULL; release it with uringSeen once handled
+struct io_uring_cqe *uringPeek(struct uring *ring);
+void uringSeen(struct uring *ring);
+
+#endif